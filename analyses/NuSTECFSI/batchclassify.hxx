@@ -0,0 +1,224 @@
+#pragma once
+
+#include "commonana.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// the AVX2 path is built for any x86 target and only used if the CPU has
+// AVX2, the SSE2 path only where the target guarantees SSE2
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUSTEC_BATCH_X86
+#ifdef __SSE2__
+#define NUSTEC_BATCH_SSE2
+#endif
+#endif
+
+// Classifies blocks of events from flat per-particle pid and energy arrays,
+// the particles of event i are [offsets[i], offsets[i+1]). If mask is
+// non-zero only particles with (flags[j] & mask) are counted. The species are
+// counted with SIMD compares where the CPU supports it and the topology is
+// then looked up in the table generated from Topologies, so the result is
+// always identical to GetClassification(PDGCounts).
+
+namespace BatchClassify {
+
+// GetClassification(PDGCounts) is already a table lookup
+inline Classification Lookup(PDGCounts const &c) {
+  return GetClassification(c);
+}
+
+inline void CountScalar(int32_t const *pid, double const *E,
+                        uint8_t const *flags, uint8_t mask, uint64_t begin,
+                        uint64_t end, double ToGeV, PDGCounts &c) {
+  for (uint64_t j = begin; j < end; ++j) {
+    if (mask && !(flags[j] & mask)) {
+      continue;
+    }
+    c.add(pid[j], E[j] * ToGeV);
+  }
+}
+
+inline void Scalar(int32_t const *pid, double const *E, uint8_t const *flags,
+                   uint8_t mask, uint64_t const *offsets, size_t nevents,
+                   double ToGeV, Classification *out) {
+  for (size_t i = 0; i < nevents; ++i) {
+    PDGCounts c;
+    CountScalar(pid, E, flags, mask, offsets[i], offsets[i + 1], ToGeV, c);
+    out[i] = Lookup(c);
+  }
+}
+
+#ifdef NUSTEC_BATCH_X86
+
+// per-lane bit masks of the species in a group of particles
+struct LaneBits {
+  unsigned p, n, pi0, pip, lep, gamma, nonnuc;
+};
+
+// accumulates a group of lanes into the counts, hard gammas and non-nuclear
+// species that are not otherwise counted go into nother
+inline void AddLanes(LaneBits const &b, unsigned hardE, unsigned valid,
+                     PDGCounts &c) {
+  unsigned known = b.p | b.n | b.pi0 | b.pip | b.lep | b.gamma;
+  c.nprotons += __builtin_popcount(b.p & valid);
+  c.nneutrons += __builtin_popcount(b.n & valid);
+  c.npi0 += __builtin_popcount(b.pi0 & valid);
+  c.npip += __builtin_popcount(b.pip & valid);
+  c.nlep += __builtin_popcount(b.lep & valid);
+  c.nother += __builtin_popcount(((b.gamma & hardE) | (~known & b.nonnuc)) &
+                                 valid);
+}
+
+// lambdas do not inherit the target attribute of the enclosing function
+__attribute__((target("avx2"))) inline unsigned Bits(__m256i v) {
+  return unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(v)));
+}
+
+__attribute__((target("avx2"))) inline void
+AVX2(int32_t const *pid, double const *E, uint8_t const *flags, uint8_t mask,
+     uint64_t const *offsets, size_t nevents, double ToGeV,
+     Classification *out) {
+  __m256i const v2212 = _mm256_set1_epi32(2212);
+  __m256i const v2112 = _mm256_set1_epi32(2112);
+  __m256i const v111 = _mm256_set1_epi32(111);
+  __m256i const v211 = _mm256_set1_epi32(211);
+  __m256i const v22 = _mm256_set1_epi32(22);
+  __m256i const v10 = _mm256_set1_epi32(10);
+  __m256i const v15 = _mm256_set1_epi32(15);
+  __m256i const v1E6 = _mm256_set1_epi32(1000000);
+  __m256i const vmask = _mm256_set1_epi32(mask);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256d const vToGeV = _mm256_set1_pd(ToGeV);
+  __m256d const vthresh = _mm256_set1_pd(0.015);
+
+  for (size_t i = 0; i < nevents; ++i) {
+    PDGCounts c;
+    uint64_t j = offsets[i];
+    uint64_t end = offsets[i + 1];
+    for (; (j + 8) <= end; j += 8) {
+      __m256i p =
+          _mm256_loadu_si256(reinterpret_cast<__m256i const *>(pid + j));
+      __m256i a = _mm256_abs_epi32(p);
+
+      LaneBits b;
+      b.p = Bits(_mm256_cmpeq_epi32(p, v2212));
+      b.n = Bits(_mm256_cmpeq_epi32(p, v2112));
+      b.pi0 = Bits(_mm256_cmpeq_epi32(p, v111));
+      b.pip = Bits(_mm256_cmpeq_epi32(p, v211));
+      b.lep = Bits(_mm256_and_si256(_mm256_cmpgt_epi32(a, v10),
+                                    _mm256_cmpgt_epi32(v15, a)));
+      b.gamma = Bits(_mm256_cmpeq_epi32(p, v22));
+      b.nonnuc = Bits(_mm256_cmpgt_epi32(v1E6, p));
+
+      unsigned hardE =
+          unsigned(_mm256_movemask_pd(_mm256_cmp_pd(
+              _mm256_mul_pd(_mm256_loadu_pd(E + j), vToGeV), vthresh,
+              _CMP_GT_OQ))) |
+          (unsigned(_mm256_movemask_pd(_mm256_cmp_pd(
+               _mm256_mul_pd(_mm256_loadu_pd(E + j + 4), vToGeV), vthresh,
+               _CMP_GT_OQ)))
+           << 4);
+
+      unsigned valid = 0xFF;
+      if (mask) {
+        __m256i f = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<__m128i const *>(flags + j)));
+        valid = ~Bits(_mm256_cmpeq_epi32(_mm256_and_si256(f, vmask), zero)) &
+                0xFF;
+      }
+      AddLanes(b, hardE, valid, c);
+    }
+    CountScalar(pid, E, flags, mask, j, end, ToGeV, c);
+    out[i] = Lookup(c);
+  }
+}
+
+#ifdef NUSTEC_BATCH_SSE2
+
+// SSE2 is part of the x86-64 baseline so needs no target attribute, the
+// absolute value and unsigned byte widening are done by hand
+inline void SSE2(int32_t const *pid, double const *E, uint8_t const *flags,
+                 uint8_t mask, uint64_t const *offsets, size_t nevents,
+                 double ToGeV, Classification *out) {
+  __m128i const v2212 = _mm_set1_epi32(2212);
+  __m128i const v2112 = _mm_set1_epi32(2112);
+  __m128i const v111 = _mm_set1_epi32(111);
+  __m128i const v211 = _mm_set1_epi32(211);
+  __m128i const v22 = _mm_set1_epi32(22);
+  __m128i const v10 = _mm_set1_epi32(10);
+  __m128i const v15 = _mm_set1_epi32(15);
+  __m128i const v1E6 = _mm_set1_epi32(1000000);
+  __m128i const vmask = _mm_set1_epi32(mask);
+  __m128i const zero = _mm_setzero_si128();
+  __m128d const vToGeV = _mm_set1_pd(ToGeV);
+  __m128d const vthresh = _mm_set1_pd(0.015);
+
+  auto bits = [](__m128i v) {
+    return unsigned(_mm_movemask_ps(_mm_castsi128_ps(v)));
+  };
+
+  for (size_t i = 0; i < nevents; ++i) {
+    PDGCounts c;
+    uint64_t j = offsets[i];
+    uint64_t end = offsets[i + 1];
+    for (; (j + 4) <= end; j += 4) {
+      __m128i p = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pid + j));
+      __m128i sgn = _mm_srai_epi32(p, 31);
+      __m128i a = _mm_sub_epi32(_mm_xor_si128(p, sgn), sgn);
+
+      LaneBits b;
+      b.p = bits(_mm_cmpeq_epi32(p, v2212));
+      b.n = bits(_mm_cmpeq_epi32(p, v2112));
+      b.pi0 = bits(_mm_cmpeq_epi32(p, v111));
+      b.pip = bits(_mm_cmpeq_epi32(p, v211));
+      b.lep =
+          bits(_mm_and_si128(_mm_cmpgt_epi32(a, v10), _mm_cmplt_epi32(a, v15)));
+      b.gamma = bits(_mm_cmpeq_epi32(p, v22));
+      b.nonnuc = bits(_mm_cmplt_epi32(p, v1E6));
+
+      unsigned hardE =
+          unsigned(_mm_movemask_pd(
+              _mm_cmpgt_pd(_mm_mul_pd(_mm_loadu_pd(E + j), vToGeV), vthresh))) |
+          (unsigned(_mm_movemask_pd(_mm_cmpgt_pd(
+               _mm_mul_pd(_mm_loadu_pd(E + j + 2), vToGeV), vthresh)))
+           << 2);
+
+      unsigned valid = 0xF;
+      if (mask) {
+        int32_t f4;
+        std::memcpy(&f4, flags + j, 4);
+        __m128i f = _mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(f4), zero), zero);
+        valid = ~bits(_mm_cmpeq_epi32(_mm_and_si128(f, vmask), zero)) & 0xF;
+      }
+      AddLanes(b, hardE, valid, c);
+    }
+    CountScalar(pid, E, flags, mask, j, end, ToGeV, c);
+    out[i] = Lookup(c);
+  }
+}
+
+#endif
+
+#endif
+
+inline void Classify(int32_t const *pid, double const *E, uint8_t const *flags,
+                     uint8_t mask, uint64_t const *offsets, size_t nevents,
+                     double ToGeV, Classification *out) {
+#ifdef NUSTEC_BATCH_X86
+  static bool const has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    return AVX2(pid, E, flags, mask, offsets, nevents, ToGeV, out);
+  }
+#endif
+#ifdef NUSTEC_BATCH_SSE2
+  return SSE2(pid, E, flags, mask, offsets, nevents, ToGeV, out);
+#else
+  return Scalar(pid, E, flags, mask, offsets, nevents, ToGeV, out);
+#endif
+}
+
+} // namespace BatchClassify
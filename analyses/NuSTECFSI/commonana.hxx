@@ -5,12 +5,18 @@
 #include "NuHepMC/Constants.hxx"
 #include "NuHepMC/EventUtils.hxx"
 
+#include "HepMC3/FourVector.h"
 #include "HepMC3/GenEvent.h"
 #include "HepMC3/GenParticle.h"
+#include "HepMC3/GenVertex.h"
 
+#include "TDirectory.h"
 #include "TH2.h"
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 enum Classification {
@@ -32,123 +38,133 @@ enum Classification {
   kNumClass
 };
 
+// The species whose multiplicities define a topology. Particles outside of
+// these (hard gammas, other non-nuclear species) always make a topology
+// kother.
+enum Species { kLep = 0, kPi0, kPiPlus, kProton, kNeutron, kNumSpecies };
+
+// inclusive multiplicity range, a negative max is unbounded
+struct Multiplicity {
+  int min;
+  int max;
+
+  constexpr bool Contains(int n) const {
+    return (n >= min) && ((max < 0) || (n <= max));
+  }
+};
+constexpr Multiplicity Exactly(int n) { return {n, n}; }
+constexpr Multiplicity AtLeast(int n) { return {n, -1}; }
+constexpr Multiplicity UpTo(int n) { return {0, n}; }
+// for topologies that the classifier never produces
+constexpr Multiplicity Never{1, 0};
+
+struct Topology {
+  Classification c;
+  // used for object names
+  char const *name;
+  // used for printing and histogram axis labels
+  char const *label;
+  // the primary particle for transparency plots, nullptr if not defined
+  char const *primpart;
+  // indexed by Species
+  Multiplicity mult[kNumSpecies];
+};
+
+// Every topology is declared here, in Classification order. An event takes
+// the first topology whose multiplicity constraints it satisfies, and kother
+// if none match. Adding a topology means adding an enumerator and a row, the
+// classifier and all of the name tables are generated from this.
+constexpr Topology Topologies[kNumClass] = {
+    //                                         lep       pi0       pi+
+    //                                         p           n
+    {k1p_only, "k1p_only", "1p", "proton",
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(1), Exactly(0)}},
+    {k1n_only, "k1n_only", "1n", "neutron",
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(0), Exactly(1)}},
+    {k1pi0_1p, "k1pi0_1p", "1pi0, 1p", "pi0",
+     {UpTo(1), Exactly(1), Exactly(0), Exactly(1), Exactly(0)}},
+    {k1piplus_1p, "k1piplus_1p", "1pi+, 1p", "piplus",
+     {UpTo(1), Exactly(0), Exactly(1), Exactly(1), Exactly(0)}},
+    {k1p_1n, "k1p_1n", "1p, 1n", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(1), Exactly(1)}},
+    {k1p_any_n, "k1p_any_n", "1p, 2+n", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(1), AtLeast(2)}},
+    // gammas are not counted, so this is never produced
+    {k1p_1gamma, "k1p_1gamma", "1p, 1gamma", nullptr,
+     {Never, Never, Never, Never, Never}},
+    {k2p_only, "k2p_only", "2p", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(2), Exactly(0)}},
+    {k2p_any_n, "k2p_any_n", "2p, 1+n", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(2), AtLeast(1)}},
+    {k3p_any_n, "k3p_any_n", "3p, 1+n", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(3), AtLeast(0)}},
+    // also takes events with no nucleons at all
+    {kany_n_only, "kany_n_only", "1+n", nullptr,
+     {UpTo(1), Exactly(0), Exactly(0), Exactly(0), AtLeast(0)}},
+    {k1pi0_any_p, "k1pi0_any_p", "1pi0, 1+p", nullptr,
+     {UpTo(1), Exactly(1), Exactly(0), AtLeast(2), Exactly(0)}},
+    {k1pi0_any_n, "k1pi0_any_n", "1pi0, 1+n", nullptr,
+     {UpTo(1), Exactly(1), Exactly(0), Exactly(0), AtLeast(1)}},
+    {k1pi0_any_np, "k1pi0_any_np", "1pi0, 1+n, 1+p", nullptr,
+     {UpTo(1), Exactly(1), Exactly(0), AtLeast(1), AtLeast(1)}},
+    {kother, "kother", "other", nullptr, {Never, Never, Never, Never, Never}},
+};
+
+constexpr bool TopologiesInOrder() {
+  for (int i = 0; i < kNumClass; ++i) {
+    if (Topologies[i].c != i) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(TopologiesInOrder(),
+              "Topologies must have one row per Classification, in order");
+
 std::vector<Classification> pclasses = {k1p_only, k1n_only, k1pi0_1p,
                                         k1piplus_1p};
 
 std::ostream &operator<<(std::ostream &os, Classification c) {
-  switch (c) {
-  case k1p_only:
-    return os << "1p";
-  case k1p_1n:
-    return os << "1p, 1n";
-  case k1p_any_n:
-    return os << "1p, 2+n";
-  case k1p_1gamma:
-    return os << "1p, 1gamma";
-  case k2p_only:
-    return os << "2p";
-  case k2p_any_n:
-    return os << "2p, 1+n";
-  case k3p_any_n:
-    return os << "3p, 1+n";
-  case k1n_only:
-    return os << "1n";
-  case kany_n_only:
-    return os << "1+n";
-  case k1pi0_1p:
-    return os << "1pi0, 1p";
-  case k1piplus_1p:
-    return os << "1pi+, 1p";
-  case k1pi0_any_p:
-    return os << "1pi0, 1+p";
-  case k1pi0_any_n:
-    return os << "1pi0, 1+n";
-  case k1pi0_any_np:
-    return os << "1pi0, 1+n, 1+p";
-  case kother:
-    return os << "other";
+  if ((c < 0) || (c >= kNumClass)) {
+    throw;
   }
-  throw;
+  return os << Topologies[c].label;
 }
 
 std::string to_string(Classification c) {
-  switch (c) {
-  case k1p_only:
-    return "k1p_only";
-  case k1p_1n:
-    return "k1p_1n";
-  case k1p_1gamma:
-    return "k1p_1gamma";
-  case k2p_only:
-    return "k2p_only";
-  case k1n_only:
-    return "k1n_only";
-  case k1pi0_1p:
-    return "k1pi0_1p";
-  case k1piplus_1p:
-    return "k1piplus_1p";
-  case k1pi0_any_p:
-    return "k1pi0_any_p";
-  case k1pi0_any_n:
-    return "k1pi0_any_n";
-  case k1pi0_any_np:
-    return "k1pi0_any_np";
-  case k1p_any_n:
-    return "k1p_any_n";
-  case k2p_any_n:
-    return "k2p_any_n";
-  case k3p_any_n:
-    return "k3p_any_n";
-  case kany_n_only:
-    return "kany_n_only";
-  case kother:
-    return "kother";
+  if ((c < 0) || (c >= kNumClass)) {
+    throw;
   }
-  throw;
+  return Topologies[c].name;
 }
 
 std::pair<std::string, std::string> TransparencyName(Classification c,
                                                      std::string suffix = "") {
 
-  std::string primpart;
-  switch (c) {
-  case k1p_only: {
-    primpart = "proton";
-    break;
-  }
-  case k1n_only: {
-    primpart = "neutron";
-    break;
-  }
-  case k1pi0_1p: {
-    primpart = "pi0";
-    break;
-  }
-  case k1piplus_1p: {
-    primpart = "piplus";
-    break;
-  }
-  default:
+  if ((c < 0) || (c >= kNumClass) || !Topologies[c].primpart) {
     throw;
   }
+  std::string primpart = Topologies[c].primpart;
 
   return {to_string(c) + "_" + primpart + "_transp" + suffix,
           to_string(c) + "_" + primpart + "_all" + suffix};
 }
 
-Classification
-GetClassification(std::vector<HepMC3::ConstGenParticlePtr> const &particles,
-                  double ToGeV) {
-
+// multiplicities of the species that the topology classification cares about
+struct PDGCounts {
   int nprotons = 0;
   int nneutrons = 0;
   int npi0 = 0;
   int npip = 0;
   int nlep = 0;
+  // anything that immediately makes the topology kother: gammas above 15 MeV
+  // and non-nuclear species not counted above
   int nother = 0;
 
-  for (auto const &pt : particles) {
-    switch (pt->pid()) {
+  void clear() { *this = PDGCounts(); }
+
+  void add(int pid, double E_GeV) {
+    switch (pid) {
     case 2212: {
       nprotons++;
       break;
@@ -177,94 +193,203 @@ GetClassification(std::vector<HepMC3::ConstGenParticlePtr> const &particles,
       break;
     }
     case 22: { // ignore gammas < 15 MeV
-      if ((pt->momentum().e() * ToGeV) > 0.015) {
-        return kother;
+      if (E_GeV > 0.015) {
+        nother++;
       }
       break;
     }
     default: {
-      if (pt->pid() < 1E6) {
-        return kother;
+      if (pid < 1E6) {
+        nother++;
       }
     }
     }
   }
+};
 
-  if ((nlep > 1) || (npi0 > 1) || (npip > 1)) {
-    return kother;
-  }
+// the subset of a GenParticle that the analysis uses, held by value so that
+// indexing an event never touches the shared_ptr reference counts
+struct Particle {
+  int pid;
+  int status;
+  HepMC3::FourVector mom;
+  // cached so that FourVector::m() is only evaluated once per particle
+  double mass;
+  double KE;
+};
 
-  if (npi0 != 0) {
-    if ((nneutrons + nprotons) == 0) {
-      return kother;
-    }
-    if (npip != 0) {
-      return kother;
-    }
-    return nneutrons ? (nprotons ? k1pi0_any_np : k1pi0_any_n)
-                     : (nprotons == 1 ? k1pi0_1p : k1pi0_any_p);
-  }
-  if (npip != 0) {
-    if ((nprotons == 1) && (nneutrons == 0)) {
-      return k1piplus_1p;
-    }
-    return kother;
-  }
+// non-owning view of a contiguous run of Particles along with their species
+// multiplicities
+struct ParticleView {
+  Particle const *data;
+  size_t n;
+  PDGCounts counts;
 
-  switch (nprotons) {
-  case 0: {
-    return (nneutrons == 1) ? k1n_only : kany_n_only;
-  }
-  case 1: {
+  Particle const *begin() const { return data; }
+  Particle const *end() const { return data + n; }
+  size_t size() const { return n; }
+  Particle const &operator[](size_t i) const { return data[i]; }
+};
 
-    return nneutrons ? ((nneutrons == 1) ? k1p_1n : k1p_any_n) : k1p_only;
-  }
-  case 2: {
-    return nneutrons ? k2p_any_n : k2p_only;
+// the particle records are stored contiguously and the storage is kept
+// between events, so steady-state indexing does not allocate
+struct ParticleList {
+  std::vector<Particle> parts;
+  PDGCounts counts;
+
+  void clear() {
+    parts.clear();
+    counts.clear();
   }
-  case 3: {
-    return k3p_any_n;
+
+  void add(int pid, int status, HepMC3::FourVector const &mom, double ToGeV) {
+    double m = mom.m();
+    parts.push_back(Particle{pid, status, mom, m, mom.e() - m});
+    counts.add(pid, mom.e() * ToGeV);
   }
-  default: {
-    return kother;
+
+  ParticleView view() const {
+    return ParticleView{parts.data(), parts.size(), counts};
   }
+};
+
+// Built once per event with a single sweep over the particles, every
+// classifier and helper works from this rather than walking the event again.
+struct EventIndex {
+  // particles leaving the primary vertex, or for GENIE the status 26 pre-FSI
+  // hadrons followed by the leptons leaving the primary vertex
+  ParticleList primary;
+  // NuHepMC::ParticleStatus::UndecayedPhysical particles
+  ParticleList final_state;
+
+  std::vector<double> weights;
+  // not filled by Build as reading the attribute allocates, callers that need
+  // it set it themselves
+  int process_id = 0;
+
+  void clear() {
+    primary.clear();
+    final_state.clear();
+    weights.clear();
+    process_id = 0;
   }
-}
 
-std::vector<HepMC3::ConstGenParticlePtr>
-GetPreFSIParticles(HepMC3::GenEvent &evt, bool isGENIE = false) {
-  if (isGENIE) {
-    std::vector<HepMC3::ConstGenParticlePtr> prefsiparts;
+  void Build(HepMC3::GenEvent &evt, double ToGeV, bool isGENIE = false) {
+    clear();
+
+    weights.insert(weights.end(), evt.weights().begin(), evt.weights().end());
+
+    // the non-const GenEvent/GenVertex accessors return references to the
+    // internal lists, the const ones return copies
     for (auto const &pt : evt.particles()) {
-      if (pt->status() == 26) {
-        prefsiparts.push_back(pt);
+      if (pt->status() == NuHepMC::ParticleStatus::UndecayedPhysical) {
+        final_state.add(pt->pid(), pt->status(), pt->momentum(), ToGeV);
+      } else if (isGENIE && (pt->status() == 26)) {
+        primary.add(pt->pid(), pt->status(), pt->momentum(), ToGeV);
       }
     }
-    for (auto const &pt :
-         NuHepMC::Event::GetPrimaryVertex(evt)->particles_out()) {
-      if ((std::abs(pt->pid()) >= 11) && (std::abs(pt->pid()) <= 16)) {
-        prefsiparts.push_back(pt);
+
+    // equivalent to NuHepMC::Event::GetPrimaryVertex
+    for (auto const &vtx : evt.vertices()) {
+      if (vtx->status() != NuHepMC::VertexStatus::Primary) {
+        continue;
+      }
+      for (auto const &pt : vtx->particles_out()) {
+        if (!isGENIE ||
+            ((std::abs(pt->pid()) >= 11) && (std::abs(pt->pid()) <= 16))) {
+          primary.add(pt->pid(), pt->status(), pt->momentum(), ToGeV);
+        }
       }
+      break;
     }
-    return prefsiparts;
-  } else {
-    return NuHepMC::Event::GetPrimaryVertex(evt)->particles_out();
   }
+
+  ParticleView Primary() const { return primary.view(); }
+  ParticleView FinalState() const { return final_state.view(); }
+};
+
+// one EventIndex per thread whose storage is reused from event to event, the
+// returned reference is only valid on the calling thread
+EventIndex &ScratchEventIndex() {
+  thread_local EventIndex idx;
+  return idx;
 }
 
-Classification PrimaryClassification(HepMC3::GenEvent &evt, double ToGeV,
-                                     bool isGENIE = false) {
-  return GetClassification(GetPreFSIParticles(evt, isGENIE), ToGeV);
+// Dense lookup table from the species multiplicities to the topology,
+// generated at compile time from Topologies. Each multiplicity is clamped to
+// one above the largest bound that any topology places on that species, all
+// larger values are classified identically.
+namespace TopologyLUT {
+constexpr int Clamp(int s) {
+  int c = 0;
+  for (auto const &t : Topologies) {
+    c = std::max(c, std::max(t.mult[s].min, t.mult[s].max) + 1);
+  }
+  return c;
 }
 
-Classification FSClassification(HepMC3::GenEvent &evt, double ToGeV) {
-  std::vector<HepMC3::ConstGenParticlePtr> fsparts;
-  for (auto const &pt : evt.particles()) {
-    if (pt->status() == NuHepMC::ParticleStatus::UndecayedPhysical) {
-      fsparts.push_back(pt);
+constexpr int Stride(int s) {
+  return (s == 0) ? 1 : Stride(s - 1) * (Clamp(s - 1) + 1);
+}
+constexpr int Size = Stride(kNumSpecies);
+
+constexpr int Index(int const (&n)[kNumSpecies]) {
+  int idx = 0;
+  for (int s = 0; s < kNumSpecies; ++s) {
+    idx += std::min(n[s], Clamp(s)) * Stride(s);
+  }
+  return idx;
+}
+
+constexpr Classification Match(int const (&n)[kNumSpecies]) {
+  for (auto const &t : Topologies) {
+    bool match = true;
+    for (int s = 0; s < kNumSpecies; ++s) {
+      match = match && t.mult[s].Contains(n[s]);
+    }
+    if (match) {
+      return t.c;
     }
   }
-  return GetClassification(fsparts, ToGeV);
+  return kother;
+}
+
+struct Table {
+  Classification c[Size];
+
+  constexpr Table() : c() {
+    for (int i = 0; i < Size; ++i) {
+      int n[kNumSpecies] = {};
+      for (int s = 0; s < kNumSpecies; ++s) {
+        n[s] = (i / Stride(s)) % (Clamp(s) + 1);
+      }
+      c[i] = Match(n);
+    }
+  }
+};
+
+constexpr Table table;
+} // namespace TopologyLUT
+
+Classification GetClassification(PDGCounts const &counts) {
+  if (counts.nother) {
+    return kother;
+  }
+  int n[kNumSpecies] = {counts.nlep, counts.npi0, counts.npip,
+                        counts.nprotons, counts.nneutrons};
+  return TopologyLUT::table.c[TopologyLUT::Index(n)];
+}
+
+Classification GetClassification(ParticleView const &parts) {
+  return GetClassification(parts.counts);
+}
+
+Classification PrimaryClassification(EventIndex const &idx) {
+  return GetClassification(idx.Primary());
+}
+
+Classification FSClassification(EventIndex const &idx) {
+  return GetClassification(idx.FinalState());
 }
 
 void RowNormTH2(TH2 *h2) {
@@ -307,4 +432,33 @@ TH1D *CutOffZeroBin(TH1 *h, int rebinx = 1) {
   }
   hc->SetDirectory(nullptr);
   return hc;
-}
\ No newline at end of file
+}
+
+// The transparency ratios and the smoothed pre-FSI kinematics are derived when
+// the output is written. They cannot be summed, so nustecmerge sums the
+// histograms that they are derived from and writes them again with these.
+
+// writes passed as <name>_unperturbed, then the passed/all ratio as <name>,
+// then all
+template <typename TH>
+void WriteTransparency(TDirectory *dout, std::unique_ptr<TH> passed,
+                       std::unique_ptr<TH> all) {
+  std::string name = std::string(passed->GetName()) + "_unperturbed";
+  dout->WriteObject(passed.get(), name.c_str());
+
+  passed->Divide(all.get());
+  name = passed->GetName();
+  dout->WriteObject(passed.release(), name.c_str());
+
+  name = all->GetName();
+  dout->WriteObject(all.release(), name.c_str());
+}
+
+// writes h as name, then a smoothed copy as <name>_smoothed
+template <typename TH>
+void WriteSmoothed(TDirectory *dout, std::unique_ptr<TH> h,
+                   std::string const &name) {
+  dout->WriteObject(h.get(), name.c_str());
+  h->Smooth();
+  dout->WriteObject(h.release(), (name + "_smoothed").c_str());
+}
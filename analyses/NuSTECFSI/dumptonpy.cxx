@@ -0,0 +1,133 @@
+#include "npy.hxx"
+
+#include "TArrayD.h"
+#include "TClass.h"
+#include "TFile.h"
+#include "TH1.h"
+#include "TKey.h"
+#include "TList.h"
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+// writes the bin edges, contents and errors of h under prefix
+bool WriteHist(NpyWriter &w, std::string const &prefix, TH1 const &h) {
+  TAxis const *axes[] = {h.GetXaxis(), h.GetYaxis(), h.GetZaxis()};
+  char const *axnames[] = {"x", "y", "z"};
+
+  // the contents and errors include the under and overflow bins, in ROOT's
+  // layout, so that they index like GetBinContent(i, j, k)
+  std::vector<size_t> shape;
+  for (int d = 0; d < h.GetDimension(); ++d) {
+    int n = axes[d]->GetNbins();
+    std::vector<double> edges;
+    for (int i = 1; i <= (n + 1); ++i) {
+      edges.push_back(axes[d]->GetBinLowEdge(i));
+    }
+    if (!w.Write(prefix + "/edges_" + axnames[d], edges.data(),
+                 {edges.size()})) {
+      return false;
+    }
+    shape.push_back(n + 2);
+  }
+
+  // the contents are written directly from the histogram's storage when they
+  // are doubles
+  size_t ncells = h.GetNcells();
+  std::vector<double> buf;
+  double const *contents = nullptr;
+  if (auto arr = dynamic_cast<TArrayD const *>(&h)) {
+    contents = arr->GetArray();
+  } else {
+    for (size_t i = 0; i < ncells; ++i) {
+      buf.push_back(h.GetBinContent(int(i)));
+    }
+    contents = buf.data();
+  }
+  if (!w.Write(prefix + "/contents", contents, shape)) {
+    return false;
+  }
+
+  std::vector<double> errors(ncells);
+  for (size_t i = 0; i < ncells; ++i) {
+    errors[i] = h.GetBinError(int(i));
+  }
+  return w.Write(prefix + "/errors", errors.data(), shape);
+}
+
+// writes every histogram in din, recursing into subdirectories such as the
+// --weights universes
+bool WriteDirectory(NpyWriter &w, std::string const &prefix, TDirectory *din) {
+  TIter next(din->GetListOfKeys());
+  while (TKey *key = static_cast<TKey *>(next())) {
+    std::string name = key->GetName();
+    if (std::string(key->GetClassName()) == "TDirectoryFile") {
+      if (!WriteDirectory(w, prefix + "/" + name,
+                          din->GetDirectory(name.c_str()))) {
+        return false;
+      }
+      continue;
+    }
+
+    // other objects, such as the provenance record, are not read at all
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    if (!cl || !cl->InheritsFrom(TH1::Class())) {
+      continue;
+    }
+    std::unique_ptr<TH1> h(static_cast<TH1 *>(key->ReadObj()));
+    if (!h) {
+      continue;
+    }
+    h->SetDirectory(nullptr);
+    if (!WriteHist(w, prefix + "/" + name, *h)) {
+      std::cout << "Failed to write " << prefix << "/" << name << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Exports every histogram in a nustecana output to NumPy arrays under
+// <generator tag>/<histogram name>/{edges_x,edges_y,edges_z,contents,errors},
+// either as .npy files under a directory or packed into one .npz archive.
+int main(int argc, char const *argv[]) {
+
+  TH1::AddDirectory(false);
+
+  bool npz = false;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--npz") {
+      npz = true;
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (posargs.size() < 3) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [--npz] <nustecana.root> <generator tag> <outdir|out.npz>"
+              << std::endl;
+    return 1;
+  }
+
+  TFile fin(posargs[0].c_str(), "READ");
+  if (fin.IsZombie()) {
+    std::cout << "Failed to open " << posargs[0] << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<NpyWriter> w;
+  if (npz) {
+    w = std::make_unique<NpzWriter>(posargs[2]);
+  } else {
+    w = std::make_unique<NpyDirWriter>(posargs[2]);
+  }
+
+  if (!WriteDirectory(*w, posargs[1], &fin) || !w->Close()) {
+    std::cout << "Failed to write " << posargs[2] << std::endl;
+    return 1;
+  }
+}
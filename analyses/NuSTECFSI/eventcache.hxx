@@ -0,0 +1,496 @@
+#pragma once
+
+#include "batchclassify.hxx"
+#include "commonana.hxx"
+
+#include "NuHepMC/Constants.hxx"
+#include "NuHepMC/EventUtils.hxx"
+#include "NuHepMC/ReaderUtils.hxx"
+
+#include "HepMC3/GenEvent.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Columnar binary cache of the event content that nustecana uses. The file is
+// a fixed header followed by one flat array per column, each starting on a
+// 64 byte boundary, so that it can be memory mapped and read in place.
+//
+// Per event columns:   part_offset (nevents + 1), weight_offset (nevents + 1),
+//                      process_id
+// Per particle columns: pid, status, flags, px, py, pz, e
+// Per weight column:   weights
+//
+// Only particles that the analysis can use are stored: final state
+// (status 1), GENIE pre-FSI (status 26) and those leaving the primary vertex.
+// They are stored in event order.
+
+namespace EventCacheFormat {
+constexpr char Magic[8] = {'N', 'U', 'S', 'T', 'E', 'C', 'E', 'C'};
+constexpr uint32_t Version = 3;
+constexpr size_t Alignment = 64;
+
+enum HeaderFlags : uint32_t { kIsGENIE = 1 };
+enum ParticleFlags : uint8_t {
+  kPrimaryVertexOut = 1,
+  // the particle is in EventIndex::primary or EventIndex::final_state, so
+  // that the topologies can be counted without re-applying the selection
+  kPreFSI = 2,
+  kFinalState = 4
+};
+
+enum Column {
+  kPartOffset = 0,
+  kWeightOffset,
+  kProcessId,
+  kWeights,
+  kPid,
+  kStatus,
+  kFlags,
+  kPx,
+  kPy,
+  kPz,
+  kE,
+  // run info: process ID numbers and the \0 separated process names
+  kProcIdNumbers,
+  kProcIdNames,
+  // run info: the \0 separated weight names
+  kWeightNames,
+  kNumColumns
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  // NuHepMC::Event::ToMeVFactor of the first event
+  double ToMeV;
+  // NuHepMC::GC2::ReadExposureNEvents, -1 if not available
+  int64_t exposure_nevents;
+  uint64_t nevents;
+  uint64_t nparticles;
+  uint64_t nweights;
+  uint64_t nprocids;
+  // byte offset from the start of the file and size in bytes of each column
+  uint64_t col_offset[kNumColumns];
+  uint64_t col_size[kNumColumns];
+};
+} // namespace EventCacheFormat
+
+// read-only memory mapped view of an event cache file
+class EventCache {
+  int fd;
+  char const *base;
+  size_t size;
+  EventCacheFormat::Header const *hdr;
+
+  template <typename T> T const *col(EventCacheFormat::Column c) const {
+    return reinterpret_cast<T const *>(base + hdr->col_offset[c]);
+  }
+
+public:
+  explicit EventCache(std::string const &fname)
+      : fd(-1), base(nullptr), size(0), hdr(nullptr) {
+    fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open event cache " + fname);
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t(st.st_size) < sizeof(*hdr))) {
+      close(fd);
+      throw std::runtime_error("Failed to stat event cache " + fname);
+    }
+    size = st.st_size;
+    void *m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Failed to mmap event cache " + fname);
+    }
+    base = static_cast<char const *>(m);
+    hdr = reinterpret_cast<EventCacheFormat::Header const *>(base);
+
+    if (std::memcmp(hdr->magic, EventCacheFormat::Magic, 8) ||
+        (hdr->version != EventCacheFormat::Version)) {
+      munmap(const_cast<char *>(base), size);
+      close(fd);
+      throw std::runtime_error(fname + " is not a version " +
+                               std::to_string(EventCacheFormat::Version) +
+                               " event cache");
+    }
+    for (int c = 0; c < EventCacheFormat::kNumColumns; ++c) {
+      if ((hdr->col_offset[c] + hdr->col_size[c]) > size) {
+        munmap(const_cast<char *>(base), size);
+        close(fd);
+        throw std::runtime_error("Event cache " + fname + " is truncated");
+      }
+    }
+  }
+
+  EventCache(EventCache const &) = delete;
+  EventCache &operator=(EventCache const &) = delete;
+
+  ~EventCache() {
+    if (base) {
+      munmap(const_cast<char *>(base), size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  static bool IsEventCache(std::string const &fname) {
+    std::ifstream ifs(fname, std::ios::binary);
+    char magic[8] = {0};
+    ifs.read(magic, 8);
+    return ifs && !std::memcmp(magic, EventCacheFormat::Magic, 8);
+  }
+
+  size_t NEvents() const { return hdr->nevents; }
+  double ToMeV() const { return hdr->ToMeV; }
+  bool IsGENIE() const { return hdr->flags & EventCacheFormat::kIsGENIE; }
+  int64_t ExposureNEvents() const { return hdr->exposure_nevents; }
+
+  NuHepMC::StatusCodeDescriptors ProcessIds() const {
+    NuHepMC::StatusCodeDescriptors pids;
+    auto ids = col<int32_t>(EventCacheFormat::kProcIdNumbers);
+    char const *name = col<char>(EventCacheFormat::kProcIdNames);
+    for (uint64_t i = 0; i < hdr->nprocids; ++i) {
+      pids[ids[i]] = {name, ""};
+      name += std::strlen(name) + 1;
+    }
+    return pids;
+  }
+
+  std::vector<std::string> WeightNames() const {
+    std::vector<std::string> names;
+    char const *name = col<char>(EventCacheFormat::kWeightNames);
+    char const *end = name + hdr->col_size[EventCacheFormat::kWeightNames];
+    while (name < end) {
+      names.emplace_back(name);
+      name += names.back().size() + 1;
+    }
+    return names;
+  }
+
+  // the number of weights stored for the first event
+  size_t NWeights() const {
+    if (!hdr->nevents) {
+      return 0;
+    }
+    auto woff = col<uint64_t>(EventCacheFormat::kWeightOffset);
+    return woff[1] - woff[0];
+  }
+
+  // the number of particles stored for events [first, first + n)
+  size_t NParticles(size_t first, size_t n) const {
+    auto poff = col<uint64_t>(EventCacheFormat::kPartOffset);
+    return poff[first + n] - poff[first];
+  }
+
+  // Asks for the rows of events [first, first + n) to be read ahead. The
+  // analysis threads each read their own blocks at scattered offsets, so
+  // each advises the block that it starts on rather than the whole mapping.
+  void WillNeed(size_t first, size_t n) const {
+    using namespace EventCacheFormat;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    auto advise = [&](Column c, size_t width, uint64_t begin, uint64_t end) {
+      uintptr_t from = uintptr_t(base + hdr->col_offset[c] + begin * width);
+      uintptr_t to = uintptr_t(base + hdr->col_offset[c] + end * width);
+      from &= ~(page - 1);
+      if (to > from) {
+        madvise(reinterpret_cast<void *>(from), to - from, MADV_WILLNEED);
+      }
+    };
+    auto poff = col<uint64_t>(kPartOffset);
+    auto woff = col<uint64_t>(kWeightOffset);
+    advise(kPartOffset, sizeof(uint64_t), first, first + n + 1);
+    advise(kWeightOffset, sizeof(uint64_t), first, first + n + 1);
+    advise(kProcessId, sizeof(int32_t), first, first + n);
+    advise(kWeights, sizeof(double), woff[first], woff[first + n]);
+    for (auto c : {kPid, kStatus}) {
+      advise(c, sizeof(int32_t), poff[first], poff[first + n]);
+    }
+    advise(kFlags, sizeof(uint8_t), poff[first], poff[first + n]);
+    for (auto c : {kPx, kPy, kPz, kE}) {
+      advise(c, sizeof(double), poff[first], poff[first + n]);
+    }
+  }
+
+  // classifies the pre-FSI topology of events [first, first + n) with the
+  // batched classifier, without building an EventIndex
+  void ClassifyPrimary(size_t first, size_t n, double ToGeV,
+                       Classification *out) const {
+    BatchClassify::Classify(
+        col<int32_t>(EventCacheFormat::kPid), col<double>(EventCacheFormat::kE),
+        col<uint8_t>(EventCacheFormat::kFlags), EventCacheFormat::kPreFSI,
+        col<uint64_t>(EventCacheFormat::kPartOffset) + first, n, ToGeV, out);
+  }
+
+  // fills idx exactly as EventIndex::Build would from the original GenEvent
+  void FillIndex(size_t ievt, EventIndex &idx, double ToGeV,
+                 bool isGENIE) const {
+    idx.clear();
+
+    auto poff = col<uint64_t>(EventCacheFormat::kPartOffset);
+    auto woff = col<uint64_t>(EventCacheFormat::kWeightOffset);
+
+    auto w = col<double>(EventCacheFormat::kWeights);
+    idx.weights.insert(idx.weights.end(), w + woff[ievt], w + woff[ievt + 1]);
+    idx.process_id = col<int32_t>(EventCacheFormat::kProcessId)[ievt];
+
+    auto pid = col<int32_t>(EventCacheFormat::kPid);
+    auto status = col<int32_t>(EventCacheFormat::kStatus);
+    auto flags = col<uint8_t>(EventCacheFormat::kFlags);
+    auto px = col<double>(EventCacheFormat::kPx);
+    auto py = col<double>(EventCacheFormat::kPy);
+    auto pz = col<double>(EventCacheFormat::kPz);
+    auto e = col<double>(EventCacheFormat::kE);
+
+    for (uint64_t i = poff[ievt]; i < poff[ievt + 1]; ++i) {
+      if (status[i] == NuHepMC::ParticleStatus::UndecayedPhysical) {
+        idx.final_state.add(pid[i], status[i],
+                            HepMC3::FourVector(px[i], py[i], pz[i], e[i]),
+                            ToGeV);
+      } else if (isGENIE && (status[i] == 26)) {
+        idx.primary.add(pid[i], status[i],
+                        HepMC3::FourVector(px[i], py[i], pz[i], e[i]), ToGeV);
+      }
+    }
+    for (uint64_t i = poff[ievt]; i < poff[ievt + 1]; ++i) {
+      if (!(flags[i] & EventCacheFormat::kPrimaryVertexOut)) {
+        continue;
+      }
+      if (!isGENIE || ((std::abs(pid[i]) >= 11) && (std::abs(pid[i]) <= 16))) {
+        idx.primary.add(pid[i], status[i],
+                        HepMC3::FourVector(px[i], py[i], pz[i], e[i]), ToGeV);
+      }
+    }
+  }
+};
+
+// Writes an event cache. Each column is streamed to its own temporary file
+// next to the output while events are added, Close() then stitches them
+// together behind the header.
+class EventCacheWriter {
+  std::string fname;
+  std::vector<std::ofstream> cols;
+  EventCacheFormat::Header hdr;
+
+  template <typename T> void put(EventCacheFormat::Column c, T const &v) {
+    cols[c].write(reinterpret_cast<char const *>(&v), sizeof(T));
+  }
+
+  std::string colname(int c) const {
+    return fname + ".col" + std::to_string(c);
+  }
+
+  // the size in bytes that column c must have for the rows added, 0 for the
+  // variable length name columns, which are not checked
+  uint64_t ExpectedSize(int c) const {
+    switch (c) {
+    case EventCacheFormat::kPartOffset:
+    case EventCacheFormat::kWeightOffset: {
+      return (hdr.nevents + 1) * sizeof(uint64_t);
+    }
+    case EventCacheFormat::kProcessId: {
+      return hdr.nevents * sizeof(int32_t);
+    }
+    case EventCacheFormat::kWeights: {
+      return hdr.nweights * sizeof(double);
+    }
+    case EventCacheFormat::kPid:
+    case EventCacheFormat::kStatus: {
+      return hdr.nparticles * sizeof(int32_t);
+    }
+    case EventCacheFormat::kFlags: {
+      return hdr.nparticles * sizeof(uint8_t);
+    }
+    case EventCacheFormat::kPx:
+    case EventCacheFormat::kPy:
+    case EventCacheFormat::kPz:
+    case EventCacheFormat::kE: {
+      return hdr.nparticles * sizeof(double);
+    }
+    case EventCacheFormat::kProcIdNumbers: {
+      return hdr.nprocids * sizeof(int32_t);
+    }
+    default: {
+      return 0;
+    }
+    }
+  }
+
+public:
+  explicit EventCacheWriter(std::string const &fn) : fname(fn), cols() {
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, EventCacheFormat::Magic, 8);
+    hdr.version = EventCacheFormat::Version;
+    hdr.exposure_nevents = -1;
+    for (int c = 0; c < EventCacheFormat::kNumColumns; ++c) {
+      cols.emplace_back(colname(c), std::ios::binary | std::ios::trunc);
+      if (!cols.back()) {
+        throw std::runtime_error("Failed to open " + colname(c));
+      }
+    }
+    put<uint64_t>(EventCacheFormat::kPartOffset, 0);
+    put<uint64_t>(EventCacheFormat::kWeightOffset, 0);
+  }
+
+  // the first event also provides the run info
+  void Add(HepMC3::GenEvent &evt) {
+    if (!hdr.nevents) {
+      hdr.ToMeV = NuHepMC::Event::ToMeVFactor(evt);
+      if (evt.run_info()->tools().size() &&
+          (evt.run_info()->tools().front().name == "GENIE")) {
+        hdr.flags |= EventCacheFormat::kIsGENIE;
+      }
+      try {
+        hdr.exposure_nevents =
+            NuHepMC::GC2::ReadExposureNEvents(evt.run_info());
+      } catch (...) {
+        // pass
+      }
+      for (auto const &pid :
+           NuHepMC::GR4::ReadProcessIdDefinitions(evt.run_info())) {
+        put<int32_t>(EventCacheFormat::kProcIdNumbers, pid.first);
+        cols[EventCacheFormat::kProcIdNames].write(
+            pid.second.first.c_str(), pid.second.first.size() + 1);
+        hdr.nprocids++;
+      }
+      for (auto const &name : evt.run_info()->weight_names()) {
+        cols[EventCacheFormat::kWeightNames].write(name.c_str(),
+                                                   name.size() + 1);
+      }
+    }
+
+    HepMC3::GenVertexPtr primvtx = nullptr;
+    for (auto const &vtx : evt.vertices()) {
+      if (vtx->status() == NuHepMC::VertexStatus::Primary) {
+        primvtx = vtx;
+        break;
+      }
+    }
+
+    for (auto const &pt : evt.particles()) {
+      bool isprimary = false;
+      if (primvtx) {
+        for (auto const &ppt : primvtx->particles_out()) {
+          if (ppt == pt) {
+            isprimary = true;
+            break;
+          }
+        }
+      }
+      if (!isprimary &&
+          (pt->status() != NuHepMC::ParticleStatus::UndecayedPhysical) &&
+          (pt->status() != 26)) {
+        continue;
+      }
+      uint8_t flags = 0;
+      if (isprimary) {
+        flags |= EventCacheFormat::kPrimaryVertexOut;
+      }
+      if (pt->status() == NuHepMC::ParticleStatus::UndecayedPhysical) {
+        flags |= EventCacheFormat::kFinalState;
+      }
+      if (hdr.flags & EventCacheFormat::kIsGENIE) {
+        if ((pt->status() == 26) ||
+            (isprimary && (std::abs(pt->pid()) >= 11) &&
+             (std::abs(pt->pid()) <= 16))) {
+          flags |= EventCacheFormat::kPreFSI;
+        }
+      } else if (isprimary) {
+        flags |= EventCacheFormat::kPreFSI;
+      }
+
+      auto const &mom = pt->momentum();
+      put<int32_t>(EventCacheFormat::kPid, pt->pid());
+      put<int32_t>(EventCacheFormat::kStatus, pt->status());
+      put<uint8_t>(EventCacheFormat::kFlags, flags);
+      put<double>(EventCacheFormat::kPx, mom.px());
+      put<double>(EventCacheFormat::kPy, mom.py());
+      put<double>(EventCacheFormat::kPz, mom.pz());
+      put<double>(EventCacheFormat::kE, mom.e());
+      hdr.nparticles++;
+    }
+
+    for (double w : evt.weights()) {
+      put<double>(EventCacheFormat::kWeights, w);
+      hdr.nweights++;
+    }
+    put<int32_t>(EventCacheFormat::kProcessId,
+                 NuHepMC::ER3::ReadProcessID(evt));
+
+    put<uint64_t>(EventCacheFormat::kPartOffset, hdr.nparticles);
+    put<uint64_t>(EventCacheFormat::kWeightOffset, hdr.nweights);
+    hdr.nevents++;
+  }
+
+  size_t NEvents() const { return hdr.nevents; }
+
+  void Close() {
+    for (int c = 0; c < EventCacheFormat::kNumColumns; ++c) {
+      cols[c].close();
+      if (!cols[c]) {
+        throw std::runtime_error("Failed to write " + colname(c));
+      }
+    }
+
+    std::ofstream out(fname, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Failed to open " + fname);
+    }
+
+    uint64_t offset = sizeof(hdr);
+    for (int c = 0; c < EventCacheFormat::kNumColumns; ++c) {
+      offset = ((offset + EventCacheFormat::Alignment - 1) /
+                EventCacheFormat::Alignment) *
+               EventCacheFormat::Alignment;
+      std::ifstream ifs(colname(c), std::ios::binary | std::ios::ate);
+      hdr.col_offset[c] = offset;
+      hdr.col_size[c] = ifs ? uint64_t(ifs.tellg()) : 0;
+      uint64_t expected = ExpectedSize(c);
+      if (!ifs || (expected && (hdr.col_size[c] != expected))) {
+        throw std::runtime_error(colname(c) + " holds " +
+                                 std::to_string(hdr.col_size[c]) +
+                                 " bytes, expected " +
+                                 std::to_string(expected) + " for " +
+                                 std::to_string(hdr.nevents) + " events");
+      }
+      offset += hdr.col_size[c];
+    }
+
+    out.write(reinterpret_cast<char const *>(&hdr), sizeof(hdr));
+    std::vector<char> buf(1 << 20);
+    for (int c = 0; c < EventCacheFormat::kNumColumns; ++c) {
+      // pad up to the aligned column start
+      std::vector<char> pad(hdr.col_offset[c] - uint64_t(out.tellp()), 0);
+      out.write(pad.data(), pad.size());
+
+      std::ifstream ifs(colname(c), std::ios::binary);
+      while (ifs) {
+        ifs.read(buf.data(), buf.size());
+        out.write(buf.data(), ifs.gcount());
+      }
+      if (ifs.bad()) {
+        throw std::runtime_error("Failed to read " + colname(c));
+      }
+      ifs.close();
+      std::remove(colname(c).c_str());
+    }
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Failed to write " + fname);
+    }
+  }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// simple blocking FIFO with a maximum depth, push blocks while the queue is
+// full and pop blocks while it is empty. Once closed, pop drains the remaining
+// items and then returns false.
+//
+// The time spent blocked on each side is accumulated so that the caller can
+// tell whether the producer or the consumer is the limiting stage.
+template <typename T> class BoundedQueue {
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+
+  std::chrono::nanoseconds push_wait;
+  std::chrono::nanoseconds pop_wait;
+
+  std::mutex mtx;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::condition_variable now_full;
+
+public:
+  explicit BoundedQueue(size_t cap)
+      : capacity(cap ? cap : 1), closed(false), push_wait(0), pop_wait(0) {}
+
+  bool push(T item) {
+    std::unique_lock<std::mutex> lk(mtx);
+    if (!closed && (items.size() >= capacity)) {
+      auto start = std::chrono::steady_clock::now();
+      not_full.wait(lk,
+                    [this] { return closed || (items.size() < capacity); });
+      push_wait += std::chrono::steady_clock::now() - start;
+    }
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    bool full = (items.size() >= capacity);
+    lk.unlock();
+    not_empty.notify_one();
+    if (full) {
+      now_full.notify_all();
+    }
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lk(mtx);
+    if (!closed && items.empty()) {
+      auto start = std::chrono::steady_clock::now();
+      not_empty.wait(lk, [this] { return closed || !items.empty(); });
+      pop_wait += std::chrono::steady_clock::now() - start;
+    }
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    lk.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  // blocks until the queue is full, for a queue of recycled items this means
+  // that every item has been handed back
+  void wait_full() {
+    std::unique_lock<std::mutex> lk(mtx);
+    now_full.wait(lk, [this] { return closed || (items.size() >= capacity); });
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+    now_full.notify_all();
+  }
+
+  // time spent blocked in push and pop respectively
+  double push_wait_s() {
+    std::lock_guard<std::mutex> lk(mtx);
+    return std::chrono::duration<double>(push_wait).count();
+  }
+  double pop_wait_s() {
+    std::lock_guard<std::mutex> lk(mtx);
+    return std::chrono::duration<double>(pop_wait).count();
+  }
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "commonana.hxx"
+
+#include "NuHepMC/Constants.hxx"
+
+#include "HepMC3/FourVector.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapped view of the events of an uncompressed HepMC3 ASCII
+// (Asciiv3) file that fills EventIndexes straight from the text, without
+// building a GenEvent. The event boundaries are found once when the file is
+// opened, after which any event can be indexed independently, on any thread.
+//
+// Only the lines and fields that EventIndex::Build uses are tokenised:
+//  - W: the event weights
+//  - A: the event level ProcId attribute, NuHepMC ER3, left at 0 if missing
+//  - V: id and status, to find the primary vertex
+//  - P: id, production vertex, pid, momentum and status
+// The numbers are parsed with std::from_chars, which rounds exactly as the
+// strtod that HepMC3::ReaderAscii uses, so the indexes are identical to
+// those built from the GenEvents. The run info (the header lines) is still
+// read with HepMC3, as are the units: like the other readers, the units of
+// the first event apply to the whole file.
+class FastAsciiReader {
+  int fd;
+  char const *base;
+  size_t size;
+  // the start of each event record, followed by the end of the last one
+  std::vector<size_t> offsets;
+
+  // a particle that leaves an explicit vertex with the primary status, only
+  // added to the index once the whole event has been seen
+  struct PrimaryCandidate {
+    long vtx;
+    int pid;
+    int status;
+    HepMC3::FourVector mom;
+  };
+
+  template <typename T>
+  static char const *Field(char const *p, char const *end, T &v) {
+    while ((p < end) && (*p == ' ')) {
+      ++p;
+    }
+    auto res = std::from_chars(p, end, v);
+    if (res.ec != std::errc()) {
+      throw std::runtime_error("Malformed HepMC3 ASCII line: " +
+                               std::string(p, std::find(p, end, '\n')));
+    }
+    return res.ptr;
+  }
+
+public:
+  explicit FastAsciiReader(std::string const &fname)
+      : fd(-1), base(nullptr), size(0) {
+    fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + fname);
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+      close(fd);
+      throw std::runtime_error("Failed to stat " + fname);
+    }
+    size = st.st_size;
+    if (!size) {
+      close(fd);
+      throw std::runtime_error(fname + " is empty");
+    }
+    void *m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Failed to mmap " + fname);
+    }
+    base = static_cast<char const *>(m);
+    madvise(m, size, MADV_SEQUENTIAL);
+
+    // every line starting with E starts an event, the listing ends at the
+    // first line starting with H after the header
+    char const *end = base + size;
+    char const *p = base;
+    while (p < end) {
+      if ((*p == 'E') && ((p + 1) < end) && (p[1] == ' ')) {
+        offsets.push_back(p - base);
+      } else if ((*p == 'H') && offsets.size()) {
+        break;
+      }
+      p = static_cast<char const *>(std::memchr(p, '\n', end - p));
+      p = p ? p + 1 : end;
+    }
+    offsets.push_back(p - base);
+  }
+
+  FastAsciiReader(FastAsciiReader const &) = delete;
+  FastAsciiReader &operator=(FastAsciiReader const &) = delete;
+
+  ~FastAsciiReader() {
+    if (base) {
+      munmap(const_cast<char *>(base), size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  size_t NEvents() const { return offsets.size() - 1; }
+
+  // fills idx exactly as EventIndex::Build would from the GenEvent read from
+  // event ievt, including the process ID, and returns the number of particles
+  // in the event
+  size_t FillIndex(size_t ievt, EventIndex &idx, double ToGeV,
+                   bool isGENIE) const {
+    thread_local std::vector<PrimaryCandidate> candidates;
+    thread_local std::vector<long> primary_vtxs;
+    candidates.clear();
+    primary_vtxs.clear();
+    idx.clear();
+
+    size_t nparts = 0;
+
+    char const *p = base + offsets[ievt];
+    char const *end = base + offsets[ievt + 1];
+    while (p < end) {
+      char const *eol =
+          static_cast<char const *>(std::memchr(p, '\n', end - p));
+      if (!eol) {
+        eol = end;
+      }
+
+      switch (*p) {
+      case 'W': {
+        char const *c = p + 1;
+        while ((c < eol) && (*c == ' ')) {
+          ++c;
+        }
+        while (c < eol) {
+          double w;
+          c = Field(c, eol, w);
+          idx.weights.push_back(w);
+          while ((c < eol) && (*c == ' ')) {
+            ++c;
+          }
+        }
+        break;
+      }
+      case 'A': {
+        // A <id> <name> <value>, the event's own attributes have id 0
+        long id;
+        char const *c = Field(p + 1, eol, id);
+        static char const procid[] = " ProcId ";
+        if (!id && ((eol - c) > long(sizeof(procid) - 1)) &&
+            !std::memcmp(c, procid, sizeof(procid) - 1)) {
+          Field(c + sizeof(procid) - 1, eol, idx.process_id);
+        }
+        break;
+      }
+      case 'V': {
+        long id;
+        int status;
+        Field(Field(p + 1, eol, id), eol, status);
+        if (status == NuHepMC::VertexStatus::Primary) {
+          primary_vtxs.push_back(id);
+        }
+        break;
+      }
+      case 'P': {
+        // P id parent pid px py pz e m status
+        long id, parent;
+        int pid, status;
+        double px, py, pz, e, m;
+        char const *c = Field(p + 1, eol, id);
+        c = Field(c, eol, parent);
+        c = Field(c, eol, pid);
+        c = Field(c, eol, px);
+        c = Field(c, eol, py);
+        c = Field(c, eol, pz);
+        c = Field(c, eol, e);
+        c = Field(c, eol, m);
+        Field(c, eol, status);
+        nparts++;
+
+        HepMC3::FourVector mom(px, py, pz, e);
+        if (status == NuHepMC::ParticleStatus::UndecayedPhysical) {
+          idx.final_state.add(pid, status, mom, ToGeV);
+        } else if (isGENIE && (status == 26)) {
+          idx.primary.add(pid, status, mom, ToGeV);
+        }
+        // a vertex line always precedes the particles that leave it
+        if ((parent < 0) &&
+            (std::find(primary_vtxs.begin(), primary_vtxs.end(), parent) !=
+             primary_vtxs.end())) {
+          candidates.push_back({parent, pid, status, mom});
+        }
+        break;
+      }
+      default: {
+        // E, U and blank lines
+      }
+      }
+      p = eol + 1;
+    }
+
+    // GenEvent::vertices() is ordered by id, -1 first, and Build takes the
+    // first primary vertex in that order
+    if (primary_vtxs.size()) {
+      long vtx = *std::max_element(primary_vtxs.begin(), primary_vtxs.end());
+      for (auto const &pc : candidates) {
+        if ((pc.vtx == vtx) &&
+            (!isGENIE ||
+             ((std::abs(pc.pid) >= 11) && (std::abs(pc.pid) <= 16)))) {
+          idx.primary.add(pc.pid, pc.status, pc.mom, ToGeV);
+        }
+      }
+    }
+    return nparts;
+  }
+};
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TH3D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Axis with O(1) bin lookup. Fixed-width axes use TAxis's own formula, for
+// variable edges the widest run of equal-width bins at the top of the axis
+// (our axes are uniform apart from the zero bin) gives a first guess that is
+// then corrected against the stored edges, so that the result is always the
+// same as TAxis::FindBin's binary search.
+class FastAxis {
+  int nbins;
+  double xmin, xmax;
+  bool fixed;
+
+  std::vector<double> edges;
+  // edges[ufirst] is the first edge of the uniform tail
+  int ufirst;
+  double invwidth;
+
+public:
+  FastAxis()
+      : nbins(0), xmin(0), xmax(0), fixed(true), edges(), ufirst(0),
+        invwidth(0) {}
+
+  FastAxis(int n, double min, double max)
+      : nbins(std::max(n, 1)), xmin(min), xmax(max), fixed(true), edges(),
+        ufirst(0), invwidth(0) {}
+
+  FastAxis(std::vector<double> const &e)
+      : nbins(int(e.size()) - 1), xmin(e.front()), xmax(e.back()),
+        fixed(false), edges(e), ufirst(nbins - 1), invwidth(0) {
+    double width = edges[nbins] - edges[nbins - 1];
+    while ((ufirst > 0) &&
+           (std::fabs((edges[ufirst] - edges[ufirst - 1]) - width) <
+            1E-9 * width)) {
+      ufirst--;
+    }
+    invwidth = 1.0 / width;
+  }
+
+  int GetNbins() const { return nbins; }
+  bool IsFixed() const { return fixed; }
+  double GetXmin() const { return xmin; }
+  double GetXmax() const { return xmax; }
+
+  // the bin edges, computed as TAxis::GetBinLowEdge does for fixed-width axes
+  std::vector<double> GetEdges() const {
+    if (!fixed) {
+      return edges;
+    }
+    std::vector<double> e(nbins + 1);
+    double width = (xmax - xmin) / nbins;
+    for (int i = 0; i < nbins; ++i) {
+      e[i] = xmin + i * width;
+    }
+    e[nbins] = xmax;
+    return e;
+  }
+
+  // ROOT bin number, 0 is the underflow and nbins + 1 the overflow
+  int FindBin(double x) const {
+    if (x < xmin) {
+      return 0;
+    }
+    if (!(x < xmax)) {
+      return nbins + 1;
+    }
+    if (fixed) {
+      return 1 + int(nbins * (x - xmin) / (xmax - xmin));
+    }
+
+    // i is the index of the lower edge of the bin containing x
+    int i;
+    if (x >= edges[ufirst]) {
+      i = std::min(ufirst + int((x - edges[ufirst]) * invwidth), nbins - 1);
+    } else {
+      i = int(std::upper_bound(edges.begin(), edges.begin() + ufirst, x) -
+              edges.begin()) -
+          1;
+    }
+    while ((i > 0) && (x < edges[i])) {
+      i--;
+    }
+    while ((i < (nbins - 1)) && (x >= edges[i + 1])) {
+      i++;
+    }
+    return i + 1;
+  }
+};
+
+// Weighted 1-3D histogram with contiguous sum of weights and sum of squared
+// weights arrays in ROOT's global bin layout. Fill reproduces TH1/TH2/TH3::Fill
+// exactly, including the statistics and entries. The weight is always
+// explicit, Fill(x, y, 1) is the unweighted 2D fill. The equivalent
+// TH1D/TH2D/TH3D is only built when the histogram is written.
+//
+// A histogram can hold several universes, each equivalent to a separate
+// histogram filled with its own weight for every event. The universes of a
+// cell are stored next to each other, so filling all of them is a single
+// contiguous update. Fills with a single weight apply it to every universe.
+class FastHist {
+  std::string name, title;
+  int ndim;
+  FastAxis axes[3];
+  int stride[3];
+  size_t nuniv;
+
+  // indexed by cell * nuniv + universe
+  std::vector<double> sumw, sumw2;
+  double entries;
+  // the TH1::GetStats layout: sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2,
+  // sumwxy, sumwz, sumwz2, sumwxz, sumwyz, indexed by stat * nuniv + universe
+  std::vector<double> stats;
+  // the cells filled since the last AddAndClear, so that summing a partial
+  // histogram costs the cells it holds rather than the whole binning
+  std::vector<uint8_t> dirty;
+  std::vector<uint32_t> touched;
+
+  // the same weight for every universe
+  struct Broadcast {
+    double w;
+    double operator[](size_t) const { return w; }
+  };
+
+  void Book() {
+    stride[0] = 1;
+    stride[1] = axes[0].GetNbins() + 2;
+    stride[2] = stride[1] * (axes[1].GetNbins() + 2);
+    size_t ncells = 1;
+    for (int d = 0; d < ndim; ++d) {
+      ncells *= (axes[d].GetNbins() + 2);
+    }
+    sumw.assign(ncells * nuniv, 0);
+    sumw2.assign(ncells * nuniv, 0);
+    entries = 0;
+    stats.assign(11 * nuniv, 0);
+    dirty.assign(ncells, 0);
+    touched.clear();
+  }
+
+  template <typename W> void FillCell(int bin, W const &w) {
+    if (!dirty[bin]) {
+      dirty[bin] = 1;
+      touched.push_back(bin);
+    }
+    double *__restrict sw = sumw.data() + bin * nuniv;
+    double *__restrict sw2 = sumw2.data() + bin * nuniv;
+    for (size_t u = 0; u < nuniv; ++u) {
+      sw[u] += w[u];
+      sw2[u] += w[u] * w[u];
+    }
+  }
+
+  template <typename W> void Fill1D(double x, W const &w) {
+    entries++;
+    int bin = axes[0].FindBin(x);
+    FillCell(bin, w);
+    if ((bin == 0) || (bin > axes[0].GetNbins())) {
+      return;
+    }
+    double *__restrict s = stats.data();
+    for (size_t u = 0; u < nuniv; ++u) {
+      s[u] += w[u];
+      s[nuniv + u] += w[u] * w[u];
+      s[2 * nuniv + u] += w[u] * x;
+      s[3 * nuniv + u] += w[u] * x * x;
+    }
+  }
+
+  template <typename W> void Fill2D(double x, double y, W const &w) {
+    entries++;
+    int binx = axes[0].FindBin(x);
+    int biny = axes[1].FindBin(y);
+    FillCell(biny * stride[1] + binx, w);
+    if ((binx == 0) || (binx > axes[0].GetNbins()) || (biny == 0) ||
+        (biny > axes[1].GetNbins())) {
+      return;
+    }
+    double *__restrict s = stats.data();
+    for (size_t u = 0; u < nuniv; ++u) {
+      s[u] += w[u];
+      s[nuniv + u] += w[u] * w[u];
+      s[2 * nuniv + u] += w[u] * x;
+      s[3 * nuniv + u] += w[u] * x * x;
+      s[4 * nuniv + u] += w[u] * y;
+      s[5 * nuniv + u] += w[u] * y * y;
+      s[6 * nuniv + u] += w[u] * x * y;
+    }
+  }
+
+  template <typename W> void Fill3D(double x, double y, double z, W const &w) {
+    entries++;
+    int binx = axes[0].FindBin(x);
+    int biny = axes[1].FindBin(y);
+    int binz = axes[2].FindBin(z);
+    FillCell(binz * stride[2] + biny * stride[1] + binx, w);
+    if ((binx == 0) || (binx > axes[0].GetNbins()) || (biny == 0) ||
+        (biny > axes[1].GetNbins()) || (binz == 0) ||
+        (binz > axes[2].GetNbins())) {
+      return;
+    }
+    double *__restrict s = stats.data();
+    for (size_t u = 0; u < nuniv; ++u) {
+      s[u] += w[u];
+      s[nuniv + u] += w[u] * w[u];
+      s[2 * nuniv + u] += w[u] * x;
+      s[3 * nuniv + u] += w[u] * x * x;
+      s[4 * nuniv + u] += w[u] * y;
+      s[5 * nuniv + u] += w[u] * y * y;
+      s[6 * nuniv + u] += w[u] * x * y;
+      s[7 * nuniv + u] += w[u] * z;
+      s[8 * nuniv + u] += w[u] * z * z;
+      s[9 * nuniv + u] += w[u] * x * z;
+      s[10 * nuniv + u] += w[u] * y * z;
+    }
+  }
+
+  template <typename TH> std::unique_ptr<TH> Finish(TH *h, size_t u) const {
+    double *a = h->GetArray();
+    double *a2 = h->GetSumw2()->GetArray();
+    size_t ncells = sumw.size() / nuniv;
+    for (size_t i = 0; i < ncells; ++i) {
+      a[i] = sumw[i * nuniv + u];
+      a2[i] = sumw2[i * nuniv + u];
+    }
+    double s[11];
+    for (int i = 0; i < 11; ++i) {
+      s[i] = stats[i * nuniv + u];
+    }
+    h->PutStats(s);
+    h->SetEntries(entries);
+    return std::unique_ptr<TH>(h);
+  }
+
+public:
+  FastHist() : ndim(0), nuniv(1), entries(0) {}
+
+  FastHist(std::string const &n, std::string const &t, FastAxis const &x)
+      : name(n), title(t), ndim(1), axes{x, FastAxis(), FastAxis()},
+        nuniv(1) {
+    Book();
+  }
+  FastHist(std::string const &n, std::string const &t, FastAxis const &x,
+           FastAxis const &y)
+      : name(n), title(t), ndim(2), axes{x, y, FastAxis()}, nuniv(1) {
+    Book();
+  }
+  FastHist(std::string const &n, std::string const &t, FastAxis const &x,
+           FastAxis const &y, FastAxis const &z)
+      : name(n), title(t), ndim(3), axes{x, y, z}, nuniv(1) {
+    Book();
+  }
+
+  bool IsBooked() const { return ndim; }
+
+  // rebooks the histogram with n universes, discarding anything filled
+  void SetNUniverses(size_t n) {
+    nuniv = std::max(size_t(1), n);
+    Book();
+  }
+  size_t GetNUniverses() const { return nuniv; }
+
+  void Fill(double x, double w) { Fill1D(x, Broadcast{w}); }
+  void Fill(double x, double y, double w) { Fill2D(x, y, Broadcast{w}); }
+  void Fill(double x, double y, double z, double w) {
+    Fill3D(x, y, z, Broadcast{w});
+  }
+
+  // w holds one weight per universe
+  void Fill(double x, double const *w) { Fill1D(x, w); }
+  void Fill(double x, double y, double const *w) { Fill2D(x, y, w); }
+  void Fill(double x, double y, double z, double const *w) {
+    Fill3D(x, y, z, w);
+  }
+
+  // equivalent to TH1::Add(&other, 1) for each universe
+  void Add(FastHist const &other) {
+    for (size_t i = 0; i < sumw.size(); ++i) {
+      sumw[i] += other.sumw[i];
+      sumw2[i] += other.sumw2[i];
+    }
+    for (size_t i = 0; i < stats.size(); ++i) {
+      stats[i] += other.stats[i];
+    }
+    entries += other.entries;
+  }
+
+  // Add(other) followed by clearing other, only visiting the cells that other
+  // has filled. The sums are the same as Add's, as the other cells are zero.
+  void AddAndClear(FastHist &other) {
+    for (auto c : other.touched) {
+      double *__restrict sw = sumw.data() + c * nuniv;
+      double *__restrict sw2 = sumw2.data() + c * nuniv;
+      double *__restrict osw = other.sumw.data() + c * nuniv;
+      double *__restrict osw2 = other.sumw2.data() + c * nuniv;
+      for (size_t u = 0; u < nuniv; ++u) {
+        sw[u] += osw[u];
+        sw2[u] += osw2[u];
+        osw[u] = 0;
+        osw2[u] = 0;
+      }
+      other.dirty[c] = 0;
+    }
+    other.touched.clear();
+    for (size_t i = 0; i < stats.size(); ++i) {
+      stats[i] += other.stats[i];
+      other.stats[i] = 0;
+    }
+    entries += other.entries;
+    other.entries = 0;
+  }
+
+  // the accumulated state, the binning is not stored and must match when the
+  // state is read back into a histogram booked the same way
+  void Save(std::ostream &os) const {
+    uint64_t ncells = sumw.size();
+    os.write(reinterpret_cast<char const *>(&ncells), sizeof(ncells));
+    os.write(reinterpret_cast<char const *>(sumw.data()),
+             ncells * sizeof(double));
+    os.write(reinterpret_cast<char const *>(sumw2.data()),
+             ncells * sizeof(double));
+    os.write(reinterpret_cast<char const *>(&entries), sizeof(entries));
+    os.write(reinterpret_cast<char const *>(stats.data()),
+             stats.size() * sizeof(double));
+  }
+
+  void Load(std::istream &is) {
+    uint64_t ncells = 0;
+    is.read(reinterpret_cast<char *>(&ncells), sizeof(ncells));
+    if (!is || (ncells != sumw.size())) {
+      throw std::runtime_error("Saved state of " + name +
+                               " does not match its binning");
+    }
+    is.read(reinterpret_cast<char *>(sumw.data()), ncells * sizeof(double));
+    is.read(reinterpret_cast<char *>(sumw2.data()), ncells * sizeof(double));
+    is.read(reinterpret_cast<char *>(&entries), sizeof(entries));
+    is.read(reinterpret_cast<char *>(stats.data()),
+            stats.size() * sizeof(double));
+    if (!is) {
+      throw std::runtime_error("Saved state of " + name + " is truncated");
+    }
+  }
+
+  std::unique_ptr<TH1D> ToTH1D(size_t u = 0) const {
+    if (axes[0].IsFixed()) {
+      return Finish(new TH1D(name.c_str(), title.c_str(), axes[0].GetNbins(),
+                             axes[0].GetXmin(), axes[0].GetXmax()), u);
+    }
+    auto x = axes[0].GetEdges();
+    return Finish(
+        new TH1D(name.c_str(), title.c_str(), x.size() - 1, x.data()), u);
+  }
+
+  std::unique_ptr<TH2D> ToTH2D(size_t u = 0) const {
+    if (axes[0].IsFixed() && axes[1].IsFixed()) {
+      return Finish(new TH2D(name.c_str(), title.c_str(), axes[0].GetNbins(),
+                             axes[0].GetXmin(), axes[0].GetXmax(),
+                             axes[1].GetNbins(), axes[1].GetXmin(),
+                             axes[1].GetXmax()), u);
+    }
+    auto x = axes[0].GetEdges();
+    auto y = axes[1].GetEdges();
+    return Finish(new TH2D(name.c_str(), title.c_str(), x.size() - 1,
+                           x.data(), y.size() - 1, y.data()), u);
+  }
+
+  std::unique_ptr<TH3D> ToTH3D(size_t u = 0) const {
+    auto x = axes[0].GetEdges();
+    auto y = axes[1].GetEdges();
+    auto z = axes[2].GetEdges();
+    return Finish(new TH3D(name.c_str(), title.c_str(), x.size() - 1,
+                           x.data(), y.size() - 1, y.data(), z.size() - 1,
+                           z.data()), u);
+  }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "commonana.hxx"
+
+#include "TClass.h"
+#include "TDirectory.h"
+#include "TH1.h"
+#include "TKey.h"
+#include "TList.h"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Sums nustecana outputs directory by directory, shared by nustecmerge and
+// nustecana --append.
+
+std::set<std::string> derived;
+std::vector<std::pair<std::string, std::string>> transparency;
+
+// the histograms that are derived when an output is written rather than summed
+void SetupDerived() {
+  derived.insert("PreFSIKinematics_1piplus_1p_smoothed");
+  for (std::string suffix : {"", "_lt5deg"}) {
+    for (auto c : pclasses) {
+      auto tn = TransparencyName(c, suffix);
+      derived.insert(tn.first);
+      transparency.push_back(tn);
+    }
+  }
+}
+
+// sums the histograms in the ins, the same directory of each input, into
+// dout, recursing into subdirectories such as the --weights universes
+bool MergeDirectory(std::vector<std::string> const &infs,
+                    std::vector<TDirectory *> const &ins, TDirectory *dout) {
+  // keep the key order of the first input so that the output is laid out
+  // like a single nustecana output
+  std::vector<std::string> names;
+  std::map<std::string, std::unique_ptr<TH1>> merged;
+  std::map<std::string, size_t> nmerged;
+  std::vector<std::string> subdirs;
+
+  for (size_t i = 0; i < ins.size(); ++i) {
+    TIter next(ins[i]->GetListOfKeys());
+    while (TKey *key = static_cast<TKey *>(next())) {
+      std::string name = key->GetName();
+      bool isdir = std::string(key->GetClassName()) == "TDirectoryFile";
+      if (!i && isdir) {
+        subdirs.push_back(name);
+      }
+      if (derived.count(name) || isdir) {
+        continue;
+      }
+
+      // other objects, such as the provenance record, are not read here
+      TClass *cl = TClass::GetClass(key->GetClassName());
+      if (!cl || !cl->InheritsFrom(TH1::Class())) {
+        continue;
+      }
+      std::unique_ptr<TH1> h(static_cast<TH1 *>(key->ReadObj()));
+      if (!h) {
+        continue;
+      }
+      h->SetDirectory(nullptr);
+
+      if (!i) {
+        names.push_back(name);
+        merged[name] = std::move(h);
+      } else if (merged.count(name)) {
+        // fails if the binning differs, as it does for TrueChannelToFSTopo
+        // between inputs that declare different process ID ranges
+        if (!merged[name]->Add(h.get())) {
+          std::cout << "Failed to add " << ins[i]->GetPath() << "/" << name
+                    << " from " << infs[i] << " to that of " << infs.front()
+                    << ", the binning differs" << std::endl;
+          return false;
+        }
+      } else {
+        std::cout << infs[i] << " contains " << ins[i]->GetPath() << "/"
+                  << name << " which is not in " << infs.front()
+                  << std::endl;
+        return false;
+      }
+      nmerged[name]++;
+    }
+  }
+
+  for (auto const &n : names) {
+    if (nmerged[n] != infs.size()) {
+      std::cout << "Only " << nmerged[n] << "/" << infs.size()
+                << " inputs contain " << n << std::endl;
+      return false;
+    }
+  }
+
+  for (auto const &n : names) {
+    auto &h = merged[n];
+    if (!h) { // already written as part of a transparency pair
+      continue;
+    }
+
+    auto tn = std::find_if(
+        transparency.begin(), transparency.end(),
+        [&](std::pair<std::string, std::string> const &t) {
+          return ((t.first + "_unperturbed") == n) || (t.second == n);
+        });
+
+    if (tn != transparency.end()) {
+      auto &passed = merged[tn->first + "_unperturbed"];
+      auto &all = merged[tn->second];
+      if (!passed || !all) {
+        std::cout << "Missing the numerator or denominator of " << tn->first
+                  << std::endl;
+        return false;
+      }
+      WriteTransparency(dout, std::move(passed), std::move(all));
+    } else if (n == "PreFSIKinematics_1piplus_1p") {
+      WriteSmoothed(dout, std::move(h), n);
+    } else {
+      dout->WriteObject(h.get(), n.c_str());
+    }
+  }
+
+  for (auto const &sd : subdirs) {
+    std::vector<TDirectory *> subins;
+    for (size_t i = 0; i < ins.size(); ++i) {
+      subins.push_back(ins[i]->GetDirectory(sd.c_str()));
+      if (!subins.back()) {
+        std::cout << infs[i] << " has no directory " << ins[i]->GetPath()
+                  << "/" << sd << std::endl;
+        return false;
+      }
+    }
+    if (!MergeDirectory(infs, subins, dout->mkdir(sd.c_str()))) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,55 @@
+// Leave this at the top to enable features detected at build time in headers in
+// HepMC3
+#include "NuHepMC/HepMC3Features.hxx"
+
+#include "eventcache.hxx"
+
+#include "HepMC3/ReaderFactory.h"
+
+#include <iostream>
+
+int main(int argc, char const *argv[]) {
+
+  if (argc < 3) {
+    std::cout << "[RUNLIKE]: " << argv[0] << " <infile.hepmc3> <outfile.nec>"
+              << std::endl;
+    return 1;
+  }
+
+  std::string inf = argv[1];
+  std::string out = argv[2];
+
+  auto rdr = HepMC3::deduce_reader(inf);
+  if (!rdr) {
+    std::cout << "Failed to instantiate HepMC3::Reader from " << inf
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    EventCacheWriter wrtr(out);
+
+    HepMC3::GenEvent evt;
+    while (!rdr->failed()) {
+      rdr->read_event(evt);
+      if (rdr->failed()) {
+        break;
+      }
+
+      wrtr.Add(evt);
+
+      if (!(wrtr.NEvents() % 10000)) {
+        std::cout << "\r                                                ";
+        std::cout << "\rConverted " << wrtr.NEvents() << " events"
+                  << std::flush;
+      }
+    }
+
+    wrtr.Close();
+    std::cout << "\rConverted " << wrtr.NEvents() << " events to " << out
+              << std::endl;
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,41 @@
+// Leave this at the top to enable features detected at build time in headers in
+// HepMC3
+#include "NuHepMC/HepMC3Features.hxx"
+
+#include "synthgen.hxx"
+
+#include <iostream>
+
+int main(int argc, char const *argv[]) {
+
+  bool genie = false;
+  uint64_t seed = 1;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--genie") {
+      genie = true;
+    } else if ((arg == "--seed") && ((i + 1) < argc)) {
+      seed = std::stoull(argv[++i]);
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (posargs.size() < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [--genie] [--seed <seed>] <outfile.hepmc3> <nevents>"
+              << std::endl;
+    return 1;
+  }
+
+  std::string out = posargs[0];
+  long nevents = std::stol(posargs[1]);
+
+  if (!WriteSyntheticEvents(out, nevents, genie, seed)) {
+    std::cout << "Failed to write " << out << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << nevents << (genie ? " GENIE-style" : "")
+            << " synthetic events to " << out << std::endl;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Writers of double arrays in NumPy's .npy format, either one file per array
+// under a directory, which numpy.load can memory-map, or all packed into an
+// uncompressed .npz archive. The array data is written straight from the
+// caller's buffer.
+//
+// Arrays of more than one dimension are written in Fortran order, which is
+// ROOT's bin layout, so that a histogram's contents index as [x, y, z].
+class NpyWriter {
+protected:
+  static std::string Header(std::vector<size_t> const &shape,
+                            bool fortran_order) {
+    uint16_t one = 1;
+    bool little = *reinterpret_cast<uint8_t const *>(&one);
+
+    std::string dict = std::string("{'descr': '") + (little ? "<" : ">") +
+                       "f8', 'fortran_order': " +
+                       (fortran_order ? "True" : "False") + ", 'shape': (";
+    for (auto n : shape) {
+      dict += std::to_string(n) + ", ";
+    }
+    dict += "), }";
+
+    // the magic string, version and header length come first, the whole
+    // header is padded with spaces to a multiple of 64 bytes and ends in \n
+    size_t len = 10 + dict.size() + 1;
+    dict += std::string((64 - (len % 64)) % 64, ' ') + "\n";
+
+    std::string hdr("\x93NUMPY\x01\x00", 8);
+    hdr += char(dict.size() & 0xFF);
+    hdr += char(dict.size() >> 8);
+    return hdr + dict;
+  }
+
+public:
+  virtual ~NpyWriter() {}
+
+  // name is a /-separated path without the .npy extension
+  virtual bool Write(std::string const &name, double const *data,
+                     std::vector<size_t> const &shape) = 0;
+  virtual bool Close() { return true; }
+};
+
+class NpyDirWriter : public NpyWriter {
+  std::filesystem::path root;
+
+public:
+  NpyDirWriter(std::filesystem::path const &root_) : root(root_) {}
+
+  bool Write(std::string const &name, double const *data,
+             std::vector<size_t> const &shape) override {
+    auto path = root / (name + ".npy");
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    size_t n = 1;
+    for (auto s : shape) {
+      n *= s;
+    }
+    std::ofstream out(path, std::ios::binary);
+    out << Header(shape, shape.size() > 1);
+    out.write(reinterpret_cast<char const *>(data), n * sizeof(double));
+    return bool(out);
+  }
+};
+
+// Entries are stored uncompressed and every field that would vary between
+// runs, such as the modification time, is fixed, so that the same
+// histograms always produce the same archive.
+class NpzWriter : public NpyWriter {
+  std::ofstream out;
+  std::string central;
+  uint64_t nentries = 0;
+
+  static uint32_t CRC32(uint32_t crc, void const *buf, size_t len) {
+    static uint32_t const *table = []() {
+      static uint32_t t[256];
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+          c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        }
+        t[i] = c;
+      }
+      return t;
+    }();
+
+    auto p = static_cast<uint8_t const *>(buf);
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+      crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  static void Put16(std::string &s, uint16_t v) {
+    s += char(v & 0xFF);
+    s += char(v >> 8);
+  }
+  static void Put32(std::string &s, uint32_t v) {
+    Put16(s, v & 0xFFFF);
+    Put16(s, v >> 16);
+  }
+
+  // the fields that the local and central directory headers share
+  static std::string Common(uint32_t crc, uint32_t size, size_t namelen) {
+    std::string s;
+    Put16(s, 20);     // version needed to extract
+    Put16(s, 0);      // flags
+    Put16(s, 0);      // stored
+    Put16(s, 0);      // time, 00:00:00
+    Put16(s, 0x0021); // date, 1980-01-01
+    Put32(s, crc);
+    Put32(s, size);
+    Put32(s, size);
+    Put16(s, uint16_t(namelen));
+    Put16(s, 0); // extra field length
+    return s;
+  }
+
+public:
+  NpzWriter(std::string const &fname) : out(fname, std::ios::binary) {}
+
+  bool Write(std::string const &name, double const *data,
+             std::vector<size_t> const &shape) override {
+    size_t n = 1;
+    for (auto s : shape) {
+      n *= s;
+    }
+    std::string hdr = Header(shape, shape.size() > 1);
+    std::string fname = name + ".npy";
+
+    uint64_t offset = uint64_t(out.tellp());
+    uint64_t size = hdr.size() + n * sizeof(double);
+    // this writer does not use the zip64 extensions
+    if (((offset + size) > std::numeric_limits<uint32_t>::max()) ||
+        (nentries == std::numeric_limits<uint16_t>::max())) {
+      return false;
+    }
+
+    uint32_t crc = CRC32(0, hdr.data(), hdr.size());
+    crc = CRC32(crc, data, n * sizeof(double));
+
+    std::string local;
+    Put32(local, 0x04034b50);
+    local += Common(crc, uint32_t(size), fname.size());
+    out << local << fname << hdr;
+    out.write(reinterpret_cast<char const *>(data), n * sizeof(double));
+
+    Put32(central, 0x02014b50);
+    Put16(central, 20); // version made by
+    central += Common(crc, uint32_t(size), fname.size());
+    Put16(central, 0); // comment length
+    Put16(central, 0); // disk number
+    Put16(central, 0); // internal attributes
+    Put32(central, 0); // external attributes
+    Put32(central, uint32_t(offset));
+    central += fname;
+    nentries++;
+
+    return bool(out);
+  }
+
+  bool Close() override {
+    uint64_t offset = uint64_t(out.tellp());
+    if ((offset + central.size()) > std::numeric_limits<uint32_t>::max()) {
+      return false;
+    }
+    std::string end;
+    Put32(end, 0x06054b50);
+    Put16(end, 0); // disk number
+    Put16(end, 0); // disk with the central directory
+    Put16(end, uint16_t(nentries));
+    Put16(end, uint16_t(nentries));
+    Put32(end, uint32_t(central.size()));
+    Put32(end, uint32_t(offset));
+    Put16(end, 0); // comment length
+    out << central << end;
+    out.close();
+    return !out.fail();
+  }
+};
@@ -3,7 +3,9 @@
 #include "NuHepMC/HepMC3Features.hxx"
 
 #include "commonana.hxx"
+#include "processevent.hxx"
 
+#include "HepMC3/ReaderAscii.h"
 #include "HepMC3/ReaderFactory.h"
 
 #include "HepMC3/GenEvent.h"
@@ -17,455 +19,1277 @@
 #include "NuHepMC/EventUtils.hxx"
 #include "NuHepMC/ReaderUtils.hxx"
 
+#include "eventcache.hxx"
+#include "eventqueue.hxx"
+#include "fastascii.hxx"
+#include "parallelinput.hxx"
+#include "merge.hxx"
+#include "prefilter.hxx"
+#include "provenance.hxx"
+#include "resultcache.hxx"
+#include "skim.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include "TFile.h"
+#include "TROOT.h"
 #include "TH1D.h"
 #include "TH2D.h"
 #include "TH3D.h"
 
-double ToGeV = 1;
 double fatx = 1;
 
 NuHepMC::StatusCodeDescriptors vtxstatus;
 NuHepMC::StatusCodeDescriptors partstatus;
 NuHepMC::StatusCodeDescriptors proc_ids;
 
-std::unique_ptr<TH2D> TrueChannelToFSTopo;
-
-// plots
-std::unique_ptr<TH1D> PreFSIKinematics_1p;
+// --skim output, with one segment per block
+std::string skim_fname;
+std::unique_ptr<SkimWriter> skim;
+
+// a batch of events handed from the reader thread to a single analysis thread
+struct EventBlock {
+  std::vector<HepMC3::GenEvent> events;
+  size_t n;
+  // the position of the block among those handed to the analysis threads,
+  // which is the order that they are summed in
+  size_t seq;
+
+  explicit EventBlock(size_t size) : events(size), n(0), seq(0) {}
+};
+
+// prints the run info and sets up the total HistSet, hists[0], followed by one
+// per analysis thread that each block is filled into before it is summed
+std::vector<HistSet> SetupHists(size_t nthreads) {
+  int min_pid = 0, max_pid = 0;
+  std::cout << "Process IDs:" << std::endl;
+  for (auto pid : proc_ids) {
+    std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
+    min_pid = std::min(min_pid, pid.first);
+    max_pid = std::max(max_pid, pid.first);
+  }
 
-std::unique_ptr<TH2D> TotalNeutronKE_1p_only;
-std::unique_ptr<TH2D> TotalNeutralE_1p_only;
+  std::cout << "Vertex Statuses:" << std::endl;
+  for (auto pid : vtxstatus) {
+    std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
+  }
 
-std::unique_ptr<TH2D> PreFSIKinematics_1piplus_1p;
+  std::cout << "Particle Statuses:" << std::endl;
+  for (auto pid : partstatus) {
+    std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
+  }
 
-std::unique_ptr<TH3D> TotalPi0E_1piplus_1p;
-std::unique_ptr<TH3D> TotalNeutralE_1piplus_1p;
+  std::vector<HistSet> hists;
+  hists.emplace_back(min_pid, max_pid);
+  for (size_t w = 0; w < nthreads; ++w) {
+    hists.push_back(hists.front());
+  }
+  return hists;
+}
 
-// transparency
-std::map<Classification,
-         std::pair<std::unique_ptr<TH1D>, std::unique_ptr<TH1D>>>
-    Transparency;
-std::map<Classification,
-         std::pair<std::unique_ptr<TH1D>, std::unique_ptr<TH1D>>>
-    Transparency_5deg;
+// Resolves a --weights selection to the event weight that each universe is
+// filled with and sets up every HistSet to fill them. The selection is a comma
+// separated list of weight names, indices and inclusive index ranges i-j, or
+// "all". Each universe is written to a directory named after its weight. An
+// empty selection keeps the single universe filled with the first weight.
+bool SetupUniverses(std::string const &spec,
+                    std::vector<std::string> const &names, size_t nweights,
+                    std::vector<HistSet> &hists) {
+  if (spec.empty()) {
+    return true;
+  }
 
-std::unique_ptr<TH2D> PrimaryToFinalStateSmearing;
+  std::vector<size_t> universes;
+  auto select = [&](size_t i) {
+    if (std::find(universes.begin(), universes.end(), i) ==
+        universes.end()) {
+      universes.push_back(i);
+    }
+  };
+
+  std::stringstream ss(spec);
+  std::string tok;
+  while (std::getline(ss, tok, ',')) {
+    auto name = std::find(names.begin(), names.end(), tok);
+    if (tok == "all") {
+      for (size_t i = 0; i < nweights; ++i) {
+        select(i);
+      }
+    } else if (name != names.end()) {
+      select(name - names.begin());
+    } else if (tok.size() && (tok.find_first_not_of("0123456789-") ==
+                              std::string::npos)) {
+      auto dash = tok.find('-');
+      size_t first = std::stoul(tok.substr(0, dash));
+      size_t last = (dash == std::string::npos)
+                        ? first
+                        : std::stoul(tok.substr(dash + 1));
+      if ((first > last) || (last >= nweights)) {
+        std::cout << "Invalid weight range " << tok << ", events have "
+                  << nweights << " weights" << std::endl;
+        return false;
+      }
+      for (size_t i = first; i <= last; ++i) {
+        select(i);
+      }
+    } else {
+      std::cout << "Unknown weight " << tok << std::endl;
+      return false;
+    }
+  }
 
-std::pair<std::unique_ptr<TH1D>, std::unique_ptr<TH1D>>
-TransparencyFact(Classification c, std::string suffix = "") {
+  std::vector<std::string> unames;
+  for (auto i : universes) {
+    std::string n =
+        (i < names.size()) ? names[i] : ("weight_" + std::to_string(i));
+    std::replace(n.begin(), n.end(), '/', '_');
+    unames.push_back(n);
+  }
 
-  std::string primpart;
-  switch (c) {
-  case k1p_only: {
-    primpart = "proton";
-    break;
+  std::cout << "Filling " << universes.size() << " weight universes"
+            << std::endl;
+  for (auto &hs : hists) {
+    hs.SetUniverses(universes, unames);
   }
-  case k1n_only: {
-    primpart = "neutron";
-    break;
+  return true;
+}
+
+// opens the --skim output, if requested, for the per-thread HistSets to add to
+bool SetupSkim(std::vector<HistSet> &hists) {
+  if (skim_fname.empty()) {
+    return true;
   }
-  case k1pi0_1p:
-  case k1pi0_any_n:
-  case k1pi0_any_np: {
-    primpart = "pi0";
-    break;
+  int min_pid = 0, max_pid = 0;
+  for (auto pid : proc_ids) {
+    min_pid = std::min(min_pid, pid.first);
+    max_pid = std::max(max_pid, pid.first);
   }
-  case k1piplus_1p: {
-    primpart = "piplus";
-    break;
+  try {
+    skim = std::make_unique<SkimWriter>(skim_fname, min_pid, max_pid,
+                                        hists.front().universe_names);
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return false;
   }
-  default:
-    throw;
+  for (size_t w = 1; w < hists.size(); ++w) {
+    hists[w].skim = skim.get();
   }
-
-  auto tn = TransparencyName(c, suffix);
-
-  return {std::make_unique<TH1D>(
-              tn.first.c_str(),
-              (";Primary " + primpart +
-               " KE (GeV); Nuclear transparency (#theta_{deflect} < 5^{#circ})")
-                  .c_str(),
-              50, 0, 1),
-          std::make_unique<TH1D>(
-              tn.second.c_str(),
-              (";Primary " + primpart +
-               " KE (GeV); Nuclear transparency (#theta_{deflect} < 5^{#circ})")
-                  .c_str(),
-              50, 0, 1)};
+  return true;
 }
 
-std::pair<double, double> GetNeutronNeutralEnergy(HepMC3::GenEvent &evt) {
-  std::pair<double, double> NeutronNeutralEnergy{0, 0};
-  for (auto const &pt : evt.particles()) {
-    if (pt->status() != NuHepMC::ParticleStatus::UndecayedPhysical) {
-      continue;
-    }
-
-    switch (std::abs(pt->pid())) {
-    case 111: {
-      NeutronNeutralEnergy.second += pt->momentum().e();
-    }
-    case 2112: {
-      double Tneut = (pt->momentum().e() - pt->momentum().m());
-      NeutronNeutralEnergy.first += Tneut;
-      NeutronNeutralEnergy.second += Tneut;
+// The slice of the input to analyse, either given directly as a first event
+// and count or as shard i of nshards equal slices of the whole input. Shard
+// ranges are resolved once the number of events in the input is known, the
+// last shard always runs to the end of the input.
+struct EventRange {
+  size_t first = 0;
+  size_t nevents = std::numeric_limits<size_t>::max();
+  size_t shard = 0;
+  size_t nshards = 0;
+
+  // total is the number of events in the input, or negative if unknown
+  bool Resolve(long total) {
+    if (nshards) {
+      if (total < 0) {
+        std::cout << "Cannot use --shard as the input does not report how "
+                     "many events it contains, use --first-event and "
+                     "--nevents instead."
+                  << std::endl;
+        return false;
+      }
+      first = (size_t(total) * shard) / nshards;
+      nevents = ((shard + 1) == nshards)
+                    ? std::numeric_limits<size_t>::max()
+                    : ((size_t(total) * (shard + 1)) / nshards) - first;
     }
+    if (first || (nevents != std::numeric_limits<size_t>::max())) {
+      std::cout << "Analysing " << nevents << " events from event " << first
+                << std::endl;
     }
+    return true;
   }
-  return NeutronNeutralEnergy;
+};
+
+// identifies the run configuration that a checkpoint belongs to, a run can be
+// resumed with any number of threads
+std::string RunId(std::string const &inf, EventRange const &range,
+                  std::string const &weights, size_t block_size) {
+  std::stringstream ss;
+  ss << inf << " first=" << range.first << " nevents=" << range.nevents
+     << " weights=" << weights << " block_size=" << block_size;
+  return ss.str();
 }
 
-std::pair<HepMC3::ConstGenParticlePtr, HepMC3::ConstGenParticlePtr>
-GetPrimaryParticles(Classification c,
-                    std::vector<HepMC3::ConstGenParticlePtr> const &parts) {
+// Periodic snapshots of the analysis so that a long run can be continued with
+// --resume after it dies. A checkpoint is only taken once every block handed
+// out has been analysed and summed. It holds the total histograms and the
+// number of events and blocks consumed. Resuming restores both and continues
+// summing from the next block, so the output is the same as that of an
+// uninterrupted run.
+//
+// HepMC3 readers do not expose their stream position, so a resumed HepMC3 run
+// passes over the consumed events with Reader::skip, which only scans for the
+// event boundaries. The event cache resumes directly at the next block.
+struct Checkpoint {
+  std::string fname;
+  size_t every_events = 0;
+  double every_seconds = 0;
+  bool resume = false;
+
+  // as of the last checkpoint taken or loaded
+  size_t nevents = 0;
+  size_t nblocks = 0;
+  std::chrono::steady_clock::time_point time =
+      std::chrono::steady_clock::now();
+
+  static constexpr char const *Magic = "NUSTECCK2";
+
+  bool Enabled() const { return every_events || (every_seconds > 0); }
+
+  // n is the number of events consumed so far
+  bool Due(size_t n) const {
+    return (every_events && ((n - nevents) >= every_events)) ||
+           ((every_seconds > 0) &&
+            (std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           time)
+                 .count() >= every_seconds));
+  }
 
-  std::pair<HepMC3::ConstGenParticlePtr, HepMC3::ConstGenParticlePtr> pparts{
-      nullptr, nullptr};
+  static void WriteString(std::ostream &os, std::string const &str) {
+    uint64_t n = str.size();
+    os.write(reinterpret_cast<char const *>(&n), sizeof(n));
+    os.write(str.data(), n);
+  }
+  static std::string ReadString(std::istream &is) {
+    uint64_t n = 0;
+    is.read(reinterpret_cast<char *>(&n), sizeof(n));
+    std::string str(is ? n : 0, '\0');
+    is.read(&str[0], str.size());
+    return str;
+  }
 
-  for (auto const &part : parts) {
-    switch (c) {
-    case k1p_only: {
-      if (part->pid() == 2212) {
-        return {part, nullptr};
+  // written to a temporary file that then replaces the previous checkpoint,
+  // so there is always a complete one to resume from
+  void Save(std::string const &id, size_t n, size_t nb,
+            HistSet const &total) {
+    std::string tmp = fname + ".tmp";
+    {
+      std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+      WriteString(os, Magic);
+      WriteString(os, id);
+      uint64_t header[2] = {n, nb};
+      os.write(reinterpret_cast<char const *>(header), sizeof(header));
+      total.Save(os);
+      if (!os) {
+        std::cout << "\nFailed to write checkpoint " << tmp << std::endl;
+        return;
       }
     }
-    case k1n_only: {
-      if (part->pid() == 2112) {
-        return {part, nullptr};
-      }
+    if (std::rename(tmp.c_str(), fname.c_str())) {
+      std::cout << "\nFailed to move checkpoint to " << fname << std::endl;
+      return;
     }
-    case k1pi0_1p: {
-      if (part->pid() == 111) {
-        pparts.first = part;
-      }
-      if (part->pid() == 2212) {
-        pparts.second = part;
-      }
+    nevents = n;
+    nblocks = nb;
+    time = std::chrono::steady_clock::now();
+  }
+
+  // total must already be set up, returns false if there is a checkpoint but
+  // it cannot be resumed by this run
+  bool Load(std::string const &id, HistSet &total) {
+    if (!resume) {
+      return true;
+    }
+    std::ifstream is(fname, std::ios::binary);
+    if (!is) {
+      std::cout << "No checkpoint found at " << fname
+                << ", starting from the beginning" << std::endl;
+      return true;
     }
-    case k1piplus_1p: {
-      if (part->pid() == 211) {
-        pparts.first = part;
+
+    try {
+      if (ReadString(is) != Magic) {
+        throw std::runtime_error(fname + " is not a nustecana checkpoint");
       }
-      if (part->pid() == 2212) {
-        pparts.second = part;
+      std::string ckid = ReadString(is);
+      if (ckid != id) {
+        throw std::runtime_error("Checkpoint " + fname + " is for the run \"" +
+                                 ckid + "\", not \"" + id + "\"");
       }
+      uint64_t header[2];
+      is.read(reinterpret_cast<char *>(header), sizeof(header));
+      if (!is) {
+        throw std::runtime_error("Checkpoint " + fname + " is truncated");
+      }
+      total.Load(is);
+      nevents = header[0];
+      nblocks = header[1];
+    } catch (std::exception const &e) {
+      std::cout << e.what() << std::endl;
+      return false;
     }
-    }
+    time = std::chrono::steady_clock::now();
+
+    std::cout << "Resuming from the checkpoint taken after " << nevents
+              << " events" << std::endl;
+    return true;
   }
-  return pparts;
-}
 
-bool isGENIE = false;
+  // once the output has been written the checkpoint is no longer needed
+  void Remove() {
+    if (Enabled() || resume) {
+      std::remove(fname.c_str());
+    }
+  }
+};
+
+// Blocks are assigned to analysis threads round-robin by block number. Each
+// thread fills a block into its own HistSet and OrderedSum then adds it to the
+// total in block order, so the output depends on neither the scheduling nor
+// the number of threads. Every input path sums the same blocks in the same
+// order, so they produce identical output for the same block size.
+bool AnalyseHepMC3(std::string const &inf, size_t nthreads, size_t block_size,
+                   EventRange &range, std::string const &weights,
+                   bool prefilter, size_t io_threads, Checkpoint &ckpt,
+                   std::vector<HistSet> &hists,
+                   std::vector<StageStats> &stats, size_t &NAnalysed) {
+  // compressed ASCII input can be decompressed on io_threads threads ahead
+  // of the parser instead of inside HepMC3's reader
+  std::shared_ptr<ParallelReaderAscii> prdr;
+  std::shared_ptr<HepMC3::Reader> rdr;
+  if (io_threads && ParallelReaderAscii::IsSupported(inf)) {
+    prdr = std::make_shared<ParallelReaderAscii>(inf, io_threads);
+    if (!prdr->Parallel()) {
+      std::cout << inf << " cannot be split for parallel decompression, "
+                << "rewrite it with recompress to decompress it on "
+                << io_threads << " threads" << std::endl;
+    }
+    rdr = prdr;
+  } else {
+    if (io_threads) {
+      std::cout << "--io-threads only applies to gzip, bzip2 or xz "
+                   "compressed HepMC3 ASCII input"
+                << std::endl;
+    }
+    rdr = HepMC3::deduce_reader(inf);
+  }
+  if (!rdr) {
+    std::cout << "Failed to instantiate HepMC3::Reader from " << inf
+              << std::endl;
+    return false;
+  }
 
-void ProcessEvent(HepMC3::GenEvent &evt) {
+  // Events are decoded on a dedicated reader thread into a fixed ring of
+  // EventBlocks. The reader takes empty blocks from free_blocks, fills them
+  // and passes them to an analysis queue, the analysis side hands them back
+  // once processed. The GenEvents are reused for the whole run.
+  size_t nring = 2 * nthreads + 2;
+  BoundedQueue<std::unique_ptr<EventBlock>> free_blocks(nring);
+  for (size_t i = 0; i < nring; ++i) {
+    free_blocks.push(std::make_unique<EventBlock>(block_size));
+  }
 
-  auto pc_pos = std::find(pclasses.begin(), pclasses.end(),
-                          PrimaryClassification(evt, ToGeV, isGENIE));
+  std::vector<std::unique_ptr<BoundedQueue<std::unique_ptr<EventBlock>>>>
+      queues;
+  for (size_t w = 0; w < nthreads; ++w) {
+    queues.emplace_back(
+        std::make_unique<BoundedQueue<std::unique_ptr<EventBlock>>>(nring));
+  }
 
-  if (pc_pos == pclasses.end()) {
-    return;
+  // the first event is read here so that the run info can be used to set up
+  // the histograms before any analysis thread starts
+  std::unique_ptr<EventBlock> blk;
+  free_blocks.pop(blk);
+  auto &first_evt = blk->events.front();
+  rdr->read_event(first_evt);
+
+  // can only reliably read run_info after reading an event, so do it on the
+  // first one
+  ToGeV = NuHepMC::Event::ToMeVFactor(first_evt) * 1E-3;
+
+  proc_ids = NuHepMC::GR4::ReadProcessIdDefinitions(first_evt.run_info());
+  vtxstatus = NuHepMC::GR5::ReadVertexStatusIdDefinitions(first_evt.run_info());
+  partstatus =
+      NuHepMC::GR6::ReadParticleStatusIdDefinitions(first_evt.run_info());
+
+  if (first_evt.run_info()->tools().size() &&
+      (first_evt.run_info()->tools().front().name == "GENIE")) {
+    isGENIE = true;
   }
-  auto pclass = *pc_pos;
 
-  auto fsclass = FSClassification(evt, ToGeV);
-  PrimaryToFinalStateSmearing->Fill(fsclass, pclass);
-  TrueChannelToFSTopo->Fill(fsclass, NuHepMC::ER3::ReadProcessID(evt));
+  hists = SetupHists(nthreads);
+  if (!SetupUniverses(weights, first_evt.run_info()->weight_names(),
+                      first_evt.weights().size(), hists) ||
+      !SetupSkim(hists)) {
+    return false;
+  }
 
-  // if (isGENIE && (pclass == k1p_only) && (fsclass == kother)) {
-  //   HepMC3::Print::listing(evt);
+  long NInput = -1;
+  try {
+    NInput = NuHepMC::GC2::ReadExposureNEvents(first_evt.run_info());
+    std::cout << "Input file reports that it contains " << NInput << " events"
+              << std::endl;
+  } catch (...) {
+    // pass
+  }
 
-  //   std::cout << "***********************" << std::endl;
-  //   for (auto const &pt : evt.particles()) {
-  //     if (pt->status() == NuHepMC::ParticleStatus::UndecayedPhysical) {
-  //       HepMC3::Print::line(pt);
-  //     }
-  //   }
-  //   std::cout << "***********************" << std::endl;
-  // }
+  if (!range.Resolve(NInput)) {
+    return false;
+  }
 
-  double w = evt.weights()[0];
+  std::string id = RunId(inf, range, weights, block_size);
+  if (!ckpt.Load(id, hists.front())) {
+    return false;
+  }
 
-  auto primparts =
-      GetPrimaryParticles(pclass, GetPreFSIParticles(evt, isGENIE));
+  size_t NSkip = range.first + ckpt.nevents;
+
+  // ProcessEvent ignores every event whose primary topology is not one of
+  // pclasses, so those can be dropped before they are decoded. The prefilter
+  // reopens the file, the first event is read again if it is accepted.
+  std::unique_ptr<PrefilterReader> pre;
+  if (prefilter) {
+    if (PrefilterReader::IsSupported(inf)) {
+      size_t nevents = range.nevents;
+      if (nevents != std::numeric_limits<size_t>::max()) {
+        nevents -= std::min(nevents, ckpt.nevents);
+      }
+      pre = std::make_unique<PrefilterReader>(inf, ToGeV, isGENIE, pclasses,
+                                              NSkip, nevents);
+      rdr->close();
+    } else {
+      std::cout << "--prefilter only supports uncompressed HepMC3 ASCII "
+                   "input, decoding every event"
+                << std::endl;
+    }
+  }
 
-  double pKE =
-      (primparts.first->momentum().e() - primparts.first->momentum().m()) *
-      ToGeV;
+  // skipping only scans for the event boundaries, which is much cheaper than
+  // decoding, the first event has already been read. Reader::skip takes an
+  // int, so a longer skip is done in chunks.
+  if (!pre && (NSkip > 1)) {
+    for (size_t left = NSkip - 1; left && !rdr->failed();) {
+      int n = int(std::min(left, size_t(std::numeric_limits<int>::max())));
+      rdr->skip(n);
+      left -= n;
+    }
+  }
 
-  if (fsclass == pclass) {
-    auto fspparts = GetPrimaryParticles(
-        pclass, NuHepMC::Event::GetParticles_All(
-                    evt, NuHepMC::ParticleStatus::UndecayedPhysical));
+  size_t NEvents = ckpt.nevents;
+  if (!pre && !rdr->failed() && !NSkip && range.nevents) {
+    NEvents++;
+    blk->n++;
+  }
+  std::cout << "Processed " << NEvents << " events";
+
+  // blocks are summed in the order that they are handed out, counted from the
+  // checkpoint as everything before it has already been summed
+  OrderedSum sum(hists.front());
+  size_t NHanded = 0;
+  auto hand_out = [&](std::unique_ptr<EventBlock> blk, size_t b) {
+    blk->seq = NHanded++;
+    queues[b % nthreads]->push(std::move(blk));
+  };
+
+  // Block k holds the accepted events among events [k, k + 1) * block_size of
+  // the range, so that every event is analysed by the same thread and in the
+  // same order as without the prefilter. Checkpoints are only taken on block
+  // boundaries and are interchangeable with those taken without it.
+  auto read_prefiltered = [&](std::unique_ptr<EventBlock> blk) {
+    size_t NBlocks = ckpt.nblocks;
+    size_t NAccepted = 0;
+    for (size_t o; (o = pre->Next()) != PrimaryPrefilter::npos;) {
+      size_t b = (ckpt.nevents + o) / block_size;
+      if (b != NBlocks) {
+        if (blk->n) {
+          hand_out(std::move(blk), NBlocks);
+        } else {
+          free_blocks.push(std::move(blk));
+        }
+        NBlocks = b;
+
+        if (ckpt.Enabled() && ckpt.Due(NBlocks * block_size)) {
+          free_blocks.wait_full();
+          ckpt.Save(id, NBlocks * block_size, NBlocks, hists.front());
+        }
+        free_blocks.pop(blk);
+      }
 
-    auto fs_mom = fspparts.first->momentum();
-    auto prim_mom = primparts.first->momentum();
+      StageClock clk(stats[nthreads]);
+      bool ok = pre->read_event(blk->events[blk->n]);
+      clk.Lap(kRead);
+      if (!ok) {
+        break;
+      }
+      blk->n++;
+      NAccepted++;
 
-    double costheta = (fs_mom.x() * prim_mom.x() + fs_mom.y() * prim_mom.y() +
-                       fs_mom.z() * prim_mom.z()) /
-                      (fs_mom.length() * prim_mom.length());
+      if ((NEvents / 10000) != ((ckpt.nevents + pre->NScanned()) / 10000)) {
+        std::cout << "\r                                                ";
+        std::cout << "\rProcessed " << (ckpt.nevents + pre->NScanned())
+                  << " events" << std::flush;
+      }
+      NEvents = ckpt.nevents + pre->NScanned();
+    }
+    NEvents = ckpt.nevents + pre->NScanned();
+    // the rejected events are only seen by the reader
+    stats[nthreads].nevents.add(pre->NScanned() - NAccepted);
 
-    double theta = std::acos((costheta > 1) ? 1 : costheta) * 180.0 / M_PI;
+    if (blk->n) {
+      hand_out(std::move(blk), NBlocks);
+    }
+    for (auto &q : queues) {
+      q->close();
+    }
+  };
 
-    if (theta < 5) {
-      Transparency_5deg[pclass].first->Fill(pKE, w);
+  std::thread reader([&, blk = std::move(blk)]() mutable {
+    if (pre) {
+      read_prefiltered(std::move(blk));
+      return;
     }
-    Transparency[pclass].first->Fill(pKE, w);
-  } // end if topo stayed the same
 
-  Transparency_5deg[pclass].second->Fill(pKE, w);
-  Transparency[pclass].second->Fill(pKE, w);
+    size_t NBlocks = ckpt.nblocks;
+    while (!rdr->failed() && (NEvents < range.nevents)) {
+      if (!blk) {
+        free_blocks.pop(blk);
+      }
+
+      if (blk->n == blk->events.size()) {
+        hand_out(std::move(blk), NBlocks++);
+
+        // once every block is back in the ring no analysis thread is
+        // touching its histograms
+        if (ckpt.Enabled() && ckpt.Due(NEvents)) {
+          free_blocks.wait_full();
+          ckpt.Save(id, NEvents, NBlocks, hists.front());
+        }
+        continue;
+      }
+
+      StageClock clk(stats[nthreads]);
+      rdr->read_event(blk->events[blk->n]);
+      clk.Lap(kRead);
+
+      if (NEvents && !(NEvents % 10000)) {
+        std::cout << "\r                                                ";
+        std::cout << "\rProcessed " << NEvents << " events" << std::flush;
+      }
+
+      if (!rdr->failed()) {
+        NEvents++;
+      } else {
+        break;
+      }
 
-  switch (pclass) {
-  case k1p_only: {
-    auto NeutronNeutralEnergy = GetNeutronNeutralEnergy(evt);
-    TotalNeutronKE_1p_only->Fill(NeutronNeutralEnergy.first * ToGeV, pKE, w);
-    TotalNeutralE_1p_only->Fill(NeutronNeutralEnergy.second * ToGeV, pKE, w);
-    PreFSIKinematics_1p->Fill(pKE, w);
-    break;
+      // if (NEvents > 1E6) {
+      //   break;
+      // }
+
+      blk->n++;
+    }
+    if (blk && blk->n) {
+      hand_out(std::move(blk), NBlocks++);
+    }
+    for (auto &q : queues) {
+      q->close();
+    }
+  });
+
+  auto analyse = [&](size_t w) {
+    std::unique_ptr<EventBlock> wblk;
+    while (queues[w]->pop(wblk)) {
+      for (size_t i = 0; i < wblk->n; ++i) {
+        auto &evt = wblk->events[i];
+        StageClock clk(stats[w]);
+        ProcessEvent(evt, hists[w + 1], clk);
+        clk.EndEvent(evt.event_number());
+      }
+      sum.Add(wblk->seq, hists[w + 1]);
+      stats[w].nevents.add(wblk->n);
+      if (stats[w].enabled) {
+        for (size_t i = 0; i < wblk->n; ++i) {
+          stats[w].nparticles.add(wblk->events[i].particles().size());
+        }
+      }
+      wblk->n = 0;
+      free_blocks.push(std::move(wblk));
+    }
+  };
+
+  if (nthreads == 1) {
+    analyse(0);
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nthreads; ++w) {
+      workers.emplace_back(analyse, w);
+    }
+    for (auto &t : workers) {
+      t.join();
+    }
   }
-  case k1piplus_1p: {
-    auto NeutronNeutralEnergy = GetNeutronNeutralEnergy(evt);
-    double pprotKE =
-        (primparts.second->momentum().e() - primparts.second->momentum().m()) *
-        ToGeV;
+  reader.join();
 
-    TotalPi0E_1piplus_1p->Fill(
-        (NeutronNeutralEnergy.second - NeutronNeutralEnergy.first) * ToGeV,
-        pprotKE, pKE, w);
-    TotalNeutralE_1piplus_1p->Fill(NeutronNeutralEnergy.second * ToGeV, pprotKE,
-                                   pKE, w);
+  std::cout << "\rProcessed " << NEvents << " events" << std::endl;
+  NAnalysed = NEvents;
+  if (prdr && prdr->DecompressionFailed()) {
+    return false;
+  }
 
-    PreFSIKinematics_1piplus_1p->Fill(pprotKE, pKE, w);
+  // if the reader spent most of its time waiting for free blocks then the
+  // analysis is the bottleneck, if the analysis threads spent most of their
+  // time waiting for filled blocks then decoding is.
+  double reader_stall = free_blocks.pop_wait_s();
+  for (auto &q : queues) {
+    reader_stall += q->push_wait_s();
+  }
+  std::cout << "Reader thread blocked for " << reader_stall
+            << " s waiting for the analysis" << std::endl;
+  for (size_t w = 0; w < nthreads; ++w) {
+    std::cout << "Analysis thread " << w << " blocked for "
+              << queues[w]->pop_wait_s() << " s waiting for the reader"
+              << std::endl;
+  }
+  return true;
+}
 
-    break;
+// Runs analyse(w, b0, b1) on each of nthreads threads, which analyses the
+// blocks in [b0, b1) that belong to thread w, for inputs that every thread
+// can read directly. With checkpointing enabled the blocks are analysed in
+// segments, with the threads joined between segments so that a checkpoint can
+// be taken.
+template <typename F>
+void AnalyseBlocks(size_t nthreads, size_t block_size, size_t NEvents,
+                   std::string const &id, Checkpoint &ckpt,
+                   std::vector<HistSet> &hists, F const &analyse) {
+  size_t NBlocks = (NEvents + block_size - 1) / block_size;
+
+  size_t segment = NBlocks;
+  if (ckpt.Enabled()) {
+    size_t rounds = 16;
+    if (ckpt.every_events) {
+      rounds = std::max(size_t(1), ckpt.every_events / (block_size * nthreads));
+    }
+    segment = rounds * nthreads;
   }
+
+  for (size_t b0 = ckpt.nblocks; b0 < NBlocks; b0 += segment) {
+    size_t b1 = std::min(NBlocks, b0 + segment);
+    if (nthreads == 1) {
+      analyse(0, b0, b1);
+    } else {
+      std::vector<std::thread> workers;
+      for (size_t w = 0; w < nthreads; ++w) {
+        workers.emplace_back(analyse, w, b0, b1);
+      }
+      for (auto &t : workers) {
+        t.join();
+      }
+    }
+
+    size_t NDone = std::min(NEvents, b1 * block_size);
+    if ((b1 < NBlocks) && ckpt.Enabled() && ckpt.Due(NDone)) {
+      ckpt.Save(id, NDone, b1, hists.front());
+      std::cout << "\rProcessed " << NDone << " events" << std::flush;
+    }
   }
+
+  std::cout << "\rProcessed " << NEvents << " events" << std::endl;
 }
 
-int main(int argc, char const *argv[]) {
+// the cache is memory mapped so there is no reader stage, each analysis
+// thread indexes its own blocks straight out of the mapping
+bool AnalyseEventCache(std::string const &inf, size_t nthreads,
+                       size_t block_size, EventRange &range,
+                       std::string const &weights, Checkpoint &ckpt,
+                       std::vector<HistSet> &hists,
+                       std::vector<StageStats> &stats, size_t &NAnalysed) {
+  std::unique_ptr<EventCache> cache;
+  try {
+    cache = std::make_unique<EventCache>(inf);
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return false;
+  }
 
-  TH1::SetDefaultSumw2(true);
+  ToGeV = cache->ToMeV() * 1E-3;
+  proc_ids = cache->ProcessIds();
+  isGENIE = cache->IsGENIE();
 
-  if (argc < 2) {
-    std::cout << "[RUNLIKE]: " << argv[0] << " <infile.hepmc3>" << std::endl;
-    return 1;
+  hists = SetupHists(nthreads);
+  if (!SetupUniverses(weights, cache->WeightNames(), cache->NWeights(),
+                      hists) ||
+      !SetupSkim(hists)) {
+    return false;
   }
 
-  std::string inf = argv[1];
-  std::string out = argv[2];
-  std::string dir = (argc > 3) ? argv[3] : "";
+  if (cache->ExposureNEvents() >= 0) {
+    std::cout << "Input file reports that it contains "
+              << cache->ExposureNEvents() << " events" << std::endl;
+  }
 
-  auto rdr = HepMC3::deduce_reader(inf);
-  if (!rdr) {
-    std::cout << "Failed to instantiate HepMC3::Reader from " << inf
-              << std::endl;
-    return 1;
+  if (!range.Resolve(cache->NEvents())) {
+    return false;
   }
 
-  HepMC3::GenEvent evt;
-
-  PrimaryToFinalStateSmearing = std::make_unique<TH2D>(
-      "PrimaryToFinalStateSmearing",
-      ";Final State topo.;Post-Hard Scatter topo.;Count", kNumClass, 0,
-      kNumClass, pclasses.size(), 0, pclasses.size());
-
-  std::vector<double> xbins = {0, 1E-8};
-  for (int i = 0; i < 80; ++i) {
-    xbins.push_back(xbins.back() + (1. / 80.));
-  }
-  std::vector<double> ybins_prot = {0, 1E-8};
-  for (int i = 0; i < 50; ++i) {
-    ybins_prot.push_back(ybins_prot.back() + (1. / 50.));
-  }
-  std::vector<double> ybins_piplus = {0, 1E-8};
-  for (int i = 0; i < 50; ++i) {
-    ybins_piplus.push_back(ybins_piplus.back() + (1 / 50.));
-  }
-
-  PreFSIKinematics_1p =
-      std::make_unique<TH1D>("PreFSIKinematics_1p", ";T_{prot}^{preFSI};Count",
-                             ybins_prot.size() - 1, ybins_prot.data());
-
-  TotalNeutronKE_1p_only = std::make_unique<TH2D>(
-      "TotalNeutronKE_1p_only", ";#sum T_{neutron};T_{prot}^{preFSI};Count",
-      xbins.size() - 1, xbins.data(), ybins_prot.size() - 1, ybins_prot.data());
-  TotalNeutralE_1p_only = std::make_unique<TH2D>(
-      "TotalNeutralE_1p_only", ";#sum E_{neutral};T_{prot}^{preFSI};Count",
-      xbins.size() - 1, xbins.data(), ybins_prot.size() - 1, ybins_prot.data());
-
-  PreFSIKinematics_1piplus_1p = std::make_unique<TH2D>(
-      "PreFSIKinematics_1piplus_1p", ";T_{prot}^{preFSI};T_{#pi+}^{preFSI};",
-      ybins_prot.size() - 1, ybins_prot.data(), ybins_piplus.size() - 1,
-      ybins_piplus.data());
-
-  TotalPi0E_1piplus_1p = std::make_unique<TH3D>(
-      "TotalPi0E_1piplus_1p",
-      ";#sum E_{#pi^{0}};T_{prot}^{preFSI};T_{#pi+}^{preFSI};Count",
-      xbins.size() - 1, xbins.data(), ybins_prot.size() - 1, ybins_prot.data(),
-      ybins_piplus.size() - 1, ybins_piplus.data());
-  TotalNeutralE_1piplus_1p = std::make_unique<TH3D>(
-      "TotalNeutralE_1piplus_1p",
-      ";#sum E_{neutral};T_{prot}^{preFSI};T_{#pi+}^{preFSI};Count",
-      xbins.size() - 1, xbins.data(), ybins_prot.size() - 1, ybins_prot.data(),
-      ybins_piplus.size() - 1, ybins_piplus.data());
-
-  Transparency[k1p_only] = TransparencyFact(k1p_only);
-  Transparency[k1n_only] = TransparencyFact(k1n_only);
-  Transparency[k1pi0_1p] = TransparencyFact(k1pi0_1p);
-  Transparency[k1piplus_1p] = TransparencyFact(k1piplus_1p);
-
-  Transparency_5deg[k1p_only] = TransparencyFact(k1p_only, "_lt5deg");
-  Transparency_5deg[k1n_only] = TransparencyFact(k1n_only, "_lt5deg");
-  Transparency_5deg[k1pi0_1p] = TransparencyFact(k1pi0_1p, "_lt5deg");
-  Transparency_5deg[k1piplus_1p] = TransparencyFact(k1piplus_1p, "_lt5deg");
-
-  size_t NEvents = 0;
-  while (!rdr->failed()) {
-    rdr->read_event(evt);
-
-    if (!NEvents) { // can only reliably read run_info after reading an event,
-                    // so do it on the first one
-      ToGeV = NuHepMC::Event::ToMeVFactor(evt) * 1E-3;
-
-      proc_ids = NuHepMC::GR4::ReadProcessIdDefinitions(evt.run_info());
-      vtxstatus = NuHepMC::GR5::ReadVertexStatusIdDefinitions(evt.run_info());
-      partstatus =
-          NuHepMC::GR6::ReadParticleStatusIdDefinitions(evt.run_info());
-
-      if (evt.run_info()->tools().size() &&
-          (evt.run_info()->tools().front().name == "GENIE")) {
-        isGENIE = true;
-      }
+  std::string id = RunId(inf, range, weights, block_size);
+  if (!ckpt.Load(id, hists.front())) {
+    return false;
+  }
 
-      int min_pid = 0, max_pid = 0;
-      std::cout << "Process IDs:" << std::endl;
-      for (auto pid : proc_ids) {
-        std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
-        min_pid = std::min(min_pid, pid.first);
-        max_pid = std::max(max_pid, pid.first);
+  size_t FirstEvent = std::min(range.first, cache->NEvents());
+  size_t NEvents = std::min(range.nevents, cache->NEvents() - FirstEvent);
+
+  // analyses blocks [b0, b1), keeping block b on thread b % nthreads
+  OrderedSum sum(hists.front(), ckpt.nblocks);
+  auto analyse = [&](size_t w, size_t b0, size_t b1) {
+    auto &idx = ScratchEventIndex();
+    std::vector<Classification> pclass(block_size);
+    for (size_t b = b0 + ((w + nthreads - (b0 % nthreads)) % nthreads); b < b1;
+         b += nthreads) {
+      size_t first = FirstEvent + b * block_size;
+      size_t last = std::min(FirstEvent + NEvents, first + block_size);
+
+      // most events are rejected on their pre-FSI topology, classify the
+      // whole block at once and only index the ones that pass
+      StageClock bclk(stats[w]);
+      cache->WillNeed(first, last - first);
+      cache->ClassifyPrimary(first, last - first, ToGeV, pclass.data());
+      bclk.Lap(kClassify);
+
+      for (size_t i = first; i < last; ++i) {
+        if (std::find(pclasses.begin(), pclasses.end(), pclass[i - first]) ==
+            pclasses.end()) {
+          continue;
+        }
+        StageClock clk(stats[w]);
+        cache->FillIndex(i, idx, ToGeV, isGENIE);
+        clk.Lap(kIndex);
+        ProcessSelected(idx, pclass[i - first], hists[w + 1], clk);
+        clk.EndEvent(i);
       }
+      sum.Add(b, hists[w + 1]);
+      stats[w].nevents.add(last - first);
+      stats[w].nparticles.add(cache->NParticles(first, last - first));
+    }
+  };
 
-      std::cout << "Vertex Statuses:" << std::endl;
-      for (auto pid : vtxstatus) {
-        std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
-      }
+  AnalyseBlocks(nthreads, block_size, NEvents, id, ckpt, hists, analyse);
+  NAnalysed = NEvents;
+  return true;
+}
 
-      std::cout << "Particle Statuses:" << std::endl;
-      for (auto pid : partstatus) {
-        std::cout << "\t" << pid.first << ": " << pid.second.first << std::endl;
-      }
+// Like the event cache, the file is memory mapped and each analysis thread
+// indexes its own blocks straight out of the mapping, with FastAsciiReader
+// parsing only the fields that the analysis uses. The run info is read with
+// HepMC3 from the first event.
+bool AnalyseFastAscii(std::string const &inf, size_t nthreads,
+                      size_t block_size, EventRange &range,
+                      std::string const &weights, Checkpoint &ckpt,
+                      std::vector<HistSet> &hists,
+                      std::vector<StageStats> &stats, size_t &NAnalysed) {
+  HepMC3::GenEvent first_evt;
+  {
+    HepMC3::ReaderAscii rdr(inf);
+    rdr.read_event(first_evt);
+    if (rdr.failed()) {
+      std::cout << "Failed to read the first event from " << inf
+                << std::endl;
+      return false;
+    }
+  }
+
+  std::unique_ptr<FastAsciiReader> fast;
+  try {
+    fast = std::make_unique<FastAsciiReader>(inf);
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return false;
+  }
+
+  ToGeV = NuHepMC::Event::ToMeVFactor(first_evt) * 1E-3;
+
+  proc_ids = NuHepMC::GR4::ReadProcessIdDefinitions(first_evt.run_info());
+  vtxstatus = NuHepMC::GR5::ReadVertexStatusIdDefinitions(first_evt.run_info());
+  partstatus =
+      NuHepMC::GR6::ReadParticleStatusIdDefinitions(first_evt.run_info());
+
+  if (first_evt.run_info()->tools().size() &&
+      (first_evt.run_info()->tools().front().name == "GENIE")) {
+    isGENIE = true;
+  }
+
+  hists = SetupHists(nthreads);
+  if (!SetupUniverses(weights, first_evt.run_info()->weight_names(),
+                      first_evt.weights().size(), hists) ||
+      !SetupSkim(hists)) {
+    return false;
+  }
+
+  // the same event count as the other readers use, so that --shard splits the
+  // input identically
+  long NInput = -1;
+  try {
+    NInput = NuHepMC::GC2::ReadExposureNEvents(first_evt.run_info());
+    std::cout << "Input file reports that it contains " << NInput << " events"
+              << std::endl;
+  } catch (...) {
+    // pass
+  }
 
-      TrueChannelToFSTopo = std::make_unique<TH2D>(
-          "TrueChannelToFSTopo", ";FSTopo;TrueChannel;Count", kNumClass, 0,
-          kNumClass, max_pid - min_pid, min_pid, max_pid);
+  if (!range.Resolve(NInput)) {
+    return false;
+  }
 
+  std::string id = RunId(inf, range, weights, block_size);
+  if (!ckpt.Load(id, hists.front())) {
+    return false;
+  }
+
+  size_t FirstEvent = std::min(range.first, fast->NEvents());
+  size_t NEvents = std::min(range.nevents, fast->NEvents() - FirstEvent);
+
+  // once an event fails to parse the remaining blocks are still summed, empty,
+  // so that no thread waits for a block that never comes
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  std::atomic<bool> failed{false};
+  OrderedSum sum(hists.front(), ckpt.nblocks);
+  auto analyse = [&](size_t w, size_t b0, size_t b1) {
+    auto &idx = ScratchEventIndex();
+    for (size_t b = b0 + ((w + nthreads - (b0 % nthreads)) % nthreads);
+         b < b1; b += nthreads) {
+      size_t first = FirstEvent + b * block_size;
+      size_t last = std::min(FirstEvent + NEvents, first + block_size);
+
+      size_t nparts = 0;
       try {
-        std::cout << "Input file reports that it contains "
-                  << NuHepMC::GC2::ReadExposureNEvents(evt.run_info())
-                  << " events" << std::endl;
+        for (size_t i = first; (i < last) && !failed; ++i) {
+          StageClock clk(stats[w]);
+          nparts += fast->FillIndex(i, idx, ToGeV, isGENIE);
+          clk.Lap(kIndex);
+          ProcessEvent(idx, hists[w + 1], clk);
+          clk.EndEvent(i);
+        }
       } catch (...) {
-        // pass
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
       }
-      std::cout << "Processed " << NEvents << " events";
+      sum.Add(b, hists[w + 1]);
+      stats[w].nevents.add(last - first);
+      stats[w].nparticles.add(nparts);
     }
+  };
+
+  AnalyseBlocks(nthreads, block_size, NEvents, id, ckpt, hists, analyse);
+  NAnalysed = NEvents;
 
-    if (NEvents && !(NEvents % 10000)) {
-      std::cout << "\r                                                ";
-      std::cout << "\rProcessed " << NEvents << " events" << std::flush;
+  if (error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (std::exception const &e) {
+      std::cout << e.what() << std::endl;
     }
+    return false;
+  }
+  return true;
+}
 
-    if (!rdr->failed()) {
-      NEvents++;
-    } else {
-      break;
+// identifies the requested slice of the input in the result cache key
+std::string RangeSpec(EventRange const &range) {
+  if (range.nshards) {
+    return "shard=" + std::to_string(range.shard) + "/" +
+           std::to_string(range.nshards);
+  }
+  if (!range.first && (range.nevents == std::numeric_limits<size_t>::max())) {
+    return "all";
+  }
+  return "first=" + std::to_string(range.first) + ",nevents=" +
+         ((range.nevents == std::numeric_limits<size_t>::max())
+              ? std::string("all")
+              : std::to_string(range.nevents));
+}
+
+// true, with a message, if input shares any event with the inputs already
+// summed into out
+bool AlreadyAdded(InputRecord const &input,
+                  std::vector<InputRecord> const &provenance,
+                  std::string const &out) {
+  for (auto const &r : provenance) {
+    if (r.Overlaps(input)) {
+      std::cout << input.Events() << " of " << input.path << " overlap "
+                << r.Events() << " of " << r.path
+                << ", which have already been added to " << out << std::endl;
+      return true;
     }
+  }
+  return false;
+}
 
-    // if (NEvents > 1E6) {
-    //   break;
-    // }
+// Sums the output of this run, already written to newf, into the existing
+// output out as nustecmerge would, through a temporary file that then
+// replaces out. The transparency ratios are rebuilt from the summed
+// numerators and denominators. Only dir is carried over, as nustecana
+// recreates its whole output file on every other run.
+bool AppendOutput(std::string const &out, std::string const &newf,
+                  std::string const &dir,
+                  std::vector<InputRecord> const &provenance) {
+  SetupDerived();
+  std::string tmp = out + ".tmp";
+  {
+    std::vector<std::string> infs = {out, newf};
+    std::vector<std::unique_ptr<TFile>> fins;
+    std::vector<TDirectory *> ins;
+    for (auto const &inf : infs) {
+      fins.emplace_back(TFile::Open(inf.c_str(), "READ"));
+      if (!fins.back() || fins.back()->IsZombie()) {
+        std::cout << "Failed to open " << inf << std::endl;
+        return false;
+      }
+      ins.push_back(dir.length() ? fins.back()->GetDirectory(dir.c_str())
+                                 : fins.back().get());
+      if (!ins.back()) {
+        std::cout << inf << " has no directory " << dir << std::endl;
+        return false;
+      }
+    }
 
-    ProcessEvent(evt);
+    TFile fmerged(tmp.c_str(), "RECREATE");
+    TDirectory *dmerged = &fmerged;
+    if (dir.length()) {
+      dmerged = fmerged.mkdir(dir.c_str());
+    }
+    if (!MergeDirectory(infs, ins, dmerged)) {
+      fmerged.Close();
+      std::remove(tmp.c_str());
+      return false;
+    }
+    WriteProvenance(dmerged, provenance);
+    fmerged.Close();
+  }
+  if (std::rename(tmp.c_str(), out.c_str())) {
+    std::cout << "Failed to move " << tmp << " to " << out << std::endl;
+    return false;
   }
-  std::cout << "Processed " << NEvents << " events" << std::endl;
+  std::remove(newf.c_str());
+  return true;
+}
 
-  for (int i = 0; i < PrimaryToFinalStateSmearing->GetXaxis()->GetNbins();
-       ++i) {
-    std::stringstream ss;
-    ss << Classification(i);
-    PrimaryToFinalStateSmearing->GetXaxis()->SetBinLabel(i + 1,
-                                                         ss.str().c_str());
+// A result cache entry records the input that it was made from at the path
+// that input had then. Points the copy of an entry in fname at input, which
+// has the same content but may be elsewhere.
+bool RecordCachedInput(std::string const &fname, std::string const &dir,
+                       InputRecord input) {
+  TFile f(fname.c_str(), "UPDATE");
+  TDirectory *d = dir.length() ? f.GetDirectory(dir.c_str()) : &f;
+  if (f.IsZombie() || !d) {
+    return false;
   }
+  auto cached = ReadProvenance(d);
+  if ((cached.size() != 1) || (cached.front().hash != input.hash)) {
+    return false;
+  }
+  input.first = cached.front().first;
+  input.nevents = cached.front().nevents;
+  WriteProvenance(d, {input});
+  f.Close();
+  return true;
+}
 
-  for (int i = 0; i < PrimaryToFinalStateSmearing->GetYaxis()->GetNbins();
-       ++i) {
-    std::stringstream ss;
-    ss << pclasses[i];
-    PrimaryToFinalStateSmearing->GetYaxis()->SetBinLabel(i + 1,
-                                                         ss.str().c_str());
+int main(int argc, char const *argv[]) {
+
+  TH1::SetDefaultSumw2(true);
+  // the ROOT histograms are built when the output is written and owned by the
+  // code that builds them, keep them out of gROOT's directory list
+  TH1::AddDirectory(false);
+
+  size_t nthreads = 1;
+  size_t block_size = 1000;
+  EventRange range;
+  Checkpoint ckpt;
+  std::string stats_json;
+  double stats_interval = 10;
+  bool prefilter = false;
+  size_t io_threads = 0;
+  bool fast_reader = false;
+  bool append = false;
+  std::string cache_dir;
+  double cache_gb = 20;
+  std::string weights;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j") && ((i + 1) < argc)) {
+      nthreads = std::max(1, std::stoi(argv[++i]));
+    } else if ((arg == "--block-size") && ((i + 1) < argc)) {
+      block_size = std::max(1, std::stoi(argv[++i]));
+    } else if ((arg == "--checkpoint-events") && ((i + 1) < argc)) {
+      ckpt.every_events = std::stoul(argv[++i]);
+    } else if ((arg == "--checkpoint-seconds") && ((i + 1) < argc)) {
+      ckpt.every_seconds = std::stod(argv[++i]);
+    } else if (arg == "--resume") {
+      ckpt.resume = true;
+    } else if ((arg == "--stats") && ((i + 1) < argc)) {
+      stats_json = argv[++i];
+    } else if ((arg == "--stats-interval") && ((i + 1) < argc)) {
+      stats_interval = std::stod(argv[++i]);
+    } else if ((arg == "--weights") && ((i + 1) < argc)) {
+      weights = argv[++i];
+    } else if (arg == "--prefilter") {
+      prefilter = true;
+    } else if ((arg == "--skim") && ((i + 1) < argc)) {
+      skim_fname = argv[++i];
+    } else if (arg == "--append") {
+      append = true;
+    } else if ((arg == "--cache-dir") && ((i + 1) < argc)) {
+      cache_dir = argv[++i];
+    } else if ((arg == "--cache-size") && ((i + 1) < argc)) {
+      cache_gb = std::stod(argv[++i]);
+    } else if (arg == "--fast-reader") {
+      fast_reader = true;
+    } else if ((arg == "--io-threads") && ((i + 1) < argc)) {
+      io_threads = std::max(0, std::stoi(argv[++i]));
+    } else if ((arg == "--first-event") && ((i + 1) < argc)) {
+      range.first = std::stoul(argv[++i]);
+    } else if ((arg == "--nevents") && ((i + 1) < argc)) {
+      range.nevents = std::stoul(argv[++i]);
+    } else if ((arg == "--shard") && ((i + 1) < argc)) {
+      // i/N
+      std::string shard = argv[++i];
+      auto slash = shard.find('/');
+      if (slash != std::string::npos) {
+        range.shard = std::stoul(shard.substr(0, slash));
+        range.nshards = std::stoul(shard.substr(slash + 1));
+      }
+      if (!range.nshards || (range.shard >= range.nshards)) {
+        std::cout << "Invalid shard " << shard
+                  << ", expected i/N with 0 <= i < N" << std::endl;
+        return 1;
+      }
+    } else {
+      posargs.push_back(arg);
+    }
   }
 
-  for (int i = 0; i < TrueChannelToFSTopo->GetXaxis()->GetNbins(); ++i) {
-    std::stringstream ss;
-    ss << Classification(i);
-    TrueChannelToFSTopo->GetXaxis()->SetBinLabel(i + 1, ss.str().c_str());
+  if (posargs.size() < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [-j <nthreads>] [--block-size <nevents>] "
+                 "[--first-event <n> --nevents <n> | --shard <i>/<N>] "
+                 "[--checkpoint-events <n>] [--checkpoint-seconds <s>] "
+                 "[--resume] [--stats <stats.json> [--stats-interval <s>]] "
+                 "[--weights <all|i,j-k,name,...>] [--prefilter] "
+                 "[--io-threads <n>] [--fast-reader] [--skim <out.skim>] "
+                 "[--append] [--cache-dir <dir> [--cache-size <GB>]] "
+                 "<infile.hepmc3|infile.nec> <outfile.root> [output dir]"
+              << std::endl;
+    return 1;
   }
 
-  TFile fout(out.c_str(), "RECREATE");
+  std::string inf = posargs[0];
+  std::string out = posargs[1];
+  std::string dir = (posargs.size() > 2) ? posargs[2] : "";
+  ckpt.fname = out + ".ckpt";
 
-  TDirectory *dout = &fout;
-  if (dir.length()) {
-    dout = fout.mkdir(dir.c_str());
+  // the events analysed before the checkpoint are not in the skim
+  if (ckpt.resume && skim_fname.length()) {
+    std::cout << "--skim cannot be used with --resume" << std::endl;
+    return 1;
   }
 
-  dout->WriteObject(TrueChannelToFSTopo.release(), "TrueChannelToFSTopo");
-  dout->WriteObject(PrimaryToFinalStateSmearing.release(),
-                    "PrimaryToFinalStateSmearing");
-
-  dout->WriteObject(PreFSIKinematics_1p.release(), "PreFSIKinematics_1p");
+  // every output records the inputs that it was filled from. With --append
+  // the run is summed into an existing output, unless that already contains
+  // these events.
+  InputRecord input;
+  std::error_code ec;
+  input.path = std::filesystem::absolute(inf, ec).string();
+  input.size = std::filesystem::file_size(inf, ec);
+  input.mtime = FileMTime(inf);
+  std::vector<InputRecord> provenance;
+  bool appending = append && std::filesystem::exists(out);
+  // the skim is only written by a run that analyses the events
+  bool caching = cache_dir.length() && !appending && skim_fname.empty();
+  if (cache_dir.length() && skim_fname.length()) {
+    std::cout << "--cache-dir is not used with --skim" << std::endl;
+  }
+  // Only an append or a cached run hashes its input, to check it against
+  // those already added or to look it up. The hashes are memoized, with the
+  // result cache if there is one, so that an input is only read again to hash
+  // it the first time and a cache hit costs a stat and a copy.
+  std::unique_ptr<HashMemo> hashes;
+  if (caching) {
+    hashes = std::make_unique<HashMemo>(std::filesystem::path(cache_dir) /
+                                        "hashes");
+  } else if (appending) {
+    hashes = std::make_unique<HashMemo>(HashMemo::DefaultDir());
+  }
+  if (appending) {
+    TFile fprev(out.c_str(), "READ");
+    TDirectory *dprev =
+        dir.length() ? fprev.GetDirectory(dir.c_str()) : &fprev;
+    if (fprev.IsZombie() || !dprev) {
+      std::cout << "Failed to open " << out << (dir.length() ? ":" : "")
+                << dir << " to append to" << std::endl;
+      return 1;
+    }
+    provenance = ReadProvenance(dprev);
+    if (provenance.empty()) {
+      std::cout << out << " does not record its inputs, cannot check that "
+                << inf << " has not already been added" << std::endl;
+    }
+    ResolveHashes(provenance, *hashes);
+  }
+  if (hashes) {
+    try {
+      input.hash = hashes->Hash(inf);
+    } catch (std::exception const &e) {
+      std::cout << e.what() << std::endl;
+      return 1;
+    }
+  }
+  // a shard is only resolved to its events once the input is opened, which
+  // is checked again once they have been analysed
+  if (appending && !range.nshards) {
+    input.first = range.first;
+    input.nevents = std::min(range.nevents,
+                             std::numeric_limits<size_t>::max() - range.first);
+    if (AlreadyAdded(input, provenance, out)) {
+      return 1;
+    }
+  }
 
-  dout->WriteObject(TotalNeutronKE_1p_only.release(), "TotalNeutronKE_1p_only");
-  dout->WriteObject(TotalNeutralE_1p_only.release(), "TotalNeutralE_1p_only");
+  // the output of a run of this build of nustecana over the same content with
+  // the same options is copied from the result cache. The blocks are summed
+  // in order, so the exact output depends on --block-size but not on -j.
+  std::unique_ptr<ResultCache> results;
+  std::string result_key;
+  if (caching) {
+    try {
+      auto exe = std::filesystem::canonical("/proc/self/exe");
+      result_key = ResultCache::Key({hashes->Hash(exe.string()), input.hash,
+                                     RangeSpec(range), weights,
+                                     std::to_string(block_size), dir});
+    } catch (std::exception const &e) {
+      std::cout << e.what() << std::endl;
+      return 1;
+    }
+    results = std::make_unique<ResultCache>(
+        cache_dir, uintmax_t(std::max(0.0, cache_gb) * 1E9));
+    std::string fetched = out + ".cached.root";
+    if (results->Fetch(result_key, fetched)) {
+      if (RecordCachedInput(fetched, dir, input) &&
+          !std::rename(fetched.c_str(), out.c_str())) {
+        std::cout << "Copied the output for " << inf << " ("
+                  << RangeSpec(range) << ") from the result cache in "
+                  << cache_dir << " to " << out << std::endl;
+        return 0;
+      }
+      std::remove(fetched.c_str());
+    }
+  }
 
-  dout->WriteObject(PreFSIKinematics_1piplus_1p.get(),
-                    "PreFSIKinematics_1piplus_1p");
-  PreFSIKinematics_1piplus_1p->Smooth();
-  dout->WriteObject(PreFSIKinematics_1piplus_1p.release(),
-                    "PreFSIKinematics_1piplus_1p_smoothed");
+  ROOT::EnableThreadSafety();
 
-  dout->WriteObject(TotalPi0E_1piplus_1p.release(), "TotalPi0E_1piplus_1p");
-  dout->WriteObject(TotalNeutralE_1piplus_1p.release(),
-                    "TotalNeutralE_1piplus_1p");
+  // one per analysis thread and one for the reader
+  std::vector<StageStats> stats(nthreads + 1);
+  for (auto &s : stats) {
+    s.enabled = stats_json.length();
+  }
+  StageReporter reporter(stats, stats_json.length() ? stats_interval : 0);
 
-  for (auto &a : Transparency) {
-    if (a.second.first) {
-      std::string name =
-          std::string(a.second.first->GetName()) + "_unperturbed";
-      dout->WriteObject(a.second.first.get(), name.c_str());
+  if (fast_reader && !EventCache::IsEventCache(inf) &&
+      !PrimaryPrefilter::IsAsciiV3(inf)) {
+    std::cout << "--fast-reader only supports uncompressed HepMC3 ASCII "
+                 "input, using the HepMC3 reader"
+              << std::endl;
+    fast_reader = false;
+  }
 
-      a.second.first->Divide(a.second.second.get());
-      name = a.second.first->GetName();
-      dout->WriteObject(a.second.first.release(), name.c_str());
+  std::vector<HistSet> hists;
+  size_t NAnalysed = 0;
+  if (EventCache::IsEventCache(inf)) {
+    if (!AnalyseEventCache(inf, nthreads, block_size, range, weights, ckpt,
+                           hists, stats, NAnalysed)) {
+      return 1;
+    }
+  } else if (fast_reader) {
+    if (!AnalyseFastAscii(inf, nthreads, block_size, range, weights, ckpt,
+                          hists, stats, NAnalysed)) {
+      return 1;
+    }
+  } else if (!AnalyseHepMC3(inf, nthreads, block_size, range, weights,
+                            prefilter, io_threads, ckpt, hists, stats,
+                            NAnalysed)) {
+    return 1;
+  }
 
-      name = a.second.second->GetName();
-      dout->WriteObject(a.second.second.release(), name.c_str());
+  reporter.Stop();
+  if (skim) {
+    try {
+      skim->Close();
+    } catch (std::exception const &e) {
+      std::cout << e.what() << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << skim->NEvents() << " selected events to "
+              << skim_fname << std::endl;
+  }
+  if (stats_json.length()) {
+    std::ofstream ofs(stats_json);
+    reporter.WriteJSON(ofs, inf, nthreads, block_size);
+    if (!ofs) {
+      std::cout << "Failed to write " << stats_json << std::endl;
     }
   }
-  for (auto &a : Transparency_5deg) {
-    if (a.second.first) {
-      std::string name =
-          std::string(a.second.first->GetName()) + "_unperturbed";
-      dout->WriteObject(a.second.first.get(), name.c_str());
 
-      a.second.first->Divide(a.second.second.get());
-      name = a.second.first->GetName();
-      dout->WriteObject(a.second.first.release(), name.c_str());
+  // the range as resolved by the run
+  input.first = range.first;
+  input.nevents = NAnalysed;
+  if (appending && AlreadyAdded(input, provenance, out)) {
+    return 1;
+  }
+  provenance.push_back(input);
+
+  // an append is written next to the output first and then summed into it
+  std::string newf = appending ? (out + ".append.root") : out;
+  TFile fout(newf.c_str(), "RECREATE");
+
+  TDirectory *dout = &fout;
+  if (dir.length()) {
+    dout = fout.mkdir(dir.c_str());
+  }
+
+  hists.front().Write(dout);
+  WriteProvenance(dout, {input});
+  fout.Close();
 
-      name = a.second.second->GetName();
-      dout->WriteObject(a.second.second.release(), name.c_str());
+  if (appending) {
+    if (!AppendOutput(out, newf, dir, provenance)) {
+      std::cout << "Failed to append to " << out << ", the histograms of "
+                << inf << " are in " << newf << std::endl;
+      return 1;
     }
+    std::cout << "Appended " << NAnalysed << " events from " << inf << " to "
+              << out << ", which now has " << provenance.size() << " inputs"
+              << std::endl;
+  }
+
+  if (results && !results->Store(result_key, out)) {
+    std::cout << "Failed to add " << out << " to the result cache in "
+              << cache_dir << std::endl;
   }
-}
\ No newline at end of file
+
+  ckpt.Remove();
+}
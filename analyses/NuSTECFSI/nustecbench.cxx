@@ -0,0 +1,335 @@
+// Leave this at the top to enable features detected at build time in headers in
+// HepMC3
+#include "NuHepMC/HepMC3Features.hxx"
+
+#include "batchclassify.hxx"
+#include "commonana.hxx"
+#include "fastascii.hxx"
+#include "prefilter.hxx"
+#include "processevent.hxx"
+#include "synthgen.hxx"
+
+#include "HepMC3/ReaderFactory.h"
+
+#include "NuHepMC/EventUtils.hxx"
+#include "NuHepMC/ReaderUtils.hxx"
+
+#include "TH1.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#include <unistd.h>
+
+// count every heap allocation made by the process so that the steady-state
+// allocation rate of the per-event helpers can be reported
+std::atomic<size_t> NAllocs{0};
+
+void *operator new(size_t size) {
+  NAllocs++;
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+// results are accumulated here so that the timed loops are not optimised away
+size_t Sink = 0;
+double DSink = 0;
+
+// Runs f once to warm up and then nrepeats timed times, and prints the fastest
+// and median time and the allocations per item. The fastest pass is the most
+// stable figure to compare between builds on a quiet machine.
+template <typename F>
+void Bench(std::string const &name, size_t nitems, size_t nrepeats, F &&f) {
+  f();
+
+  std::vector<double> ns;
+  size_t allocs_before = NAllocs;
+  for (size_t r = 0; r < nrepeats; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() /
+                 double(nitems));
+  }
+  double nallocs = double(NAllocs - allocs_before) / double(nrepeats * nitems);
+
+  std::sort(ns.begin(), ns.end());
+  std::cout << std::left << std::setw(34) << name << std::right << std::fixed
+            << std::setprecision(1) << " min " << std::setw(10) << ns.front()
+            << " ns, median " << std::setw(10) << ns[ns.size() / 2]
+            << " ns, " << std::setprecision(2) << nallocs
+            << " allocations per item" << std::defaultfloat << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+
+  bool synthetic = false;
+  bool genie = false;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--synthetic") {
+      synthetic = true;
+    } else if (arg == "--genie") {
+      genie = true;
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (!synthetic && posargs.empty()) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " <infile.hepmc3|--synthetic [--genie]> [nevents=10000] "
+                 "[nrepeats=10]"
+              << std::endl;
+    return 1;
+  }
+
+  size_t a = synthetic ? 0 : 1;
+  std::string inf = synthetic ? "" : posargs[0];
+  size_t nevents = (posargs.size() > a) ? std::stoul(posargs[a]) : 10000;
+  size_t nrepeats =
+      (posargs.size() > (a + 1)) ? std::stoul(posargs[a + 1]) : 10;
+  nrepeats = std::max(size_t(1), nrepeats);
+
+  // synthetic input is also written out so that the read loop can be timed
+  std::filesystem::path tmpfile;
+  if (synthetic) {
+    tmpfile = std::filesystem::temp_directory_path() /
+              ("nustecbench_" + std::to_string(getpid()) + ".hepmc3");
+    inf = tmpfile.string();
+    if (!WriteSyntheticEvents(inf, nevents, genie)) {
+      std::cout << "Failed to write synthetic events to " << inf << std::endl;
+      return 1;
+    }
+  }
+
+  auto rdr = HepMC3::deduce_reader(inf);
+  if (!rdr) {
+    std::cout << "Failed to instantiate HepMC3::Reader from " << inf
+              << std::endl;
+    return 1;
+  }
+
+  // keep the events in memory so that the timed loops do not include any
+  // decoding
+  std::vector<HepMC3::GenEvent> evts;
+  while (evts.size() < nevents) {
+    evts.emplace_back();
+    rdr->read_event(evts.back());
+    if (rdr->failed()) {
+      evts.pop_back();
+      break;
+    }
+  }
+  rdr->close();
+
+  if (evts.empty()) {
+    std::cout << "Failed to read any events from " << inf << std::endl;
+    return 1;
+  }
+
+  ToGeV = NuHepMC::Event::ToMeVFactor(evts.front()) * 1E-3;
+  isGENIE = evts.front().run_info()->tools().size() &&
+            (evts.front().run_info()->tools().front().name == "GENIE");
+
+  int min_pid = 0, max_pid = 0;
+  for (auto const &pid :
+       NuHepMC::GR4::ReadProcessIdDefinitions(evts.front().run_info())) {
+    min_pid = std::min(min_pid, pid.first);
+    max_pid = std::max(max_pid, pid.first);
+  }
+
+  std::cout << "Read " << evts.size() << (synthetic ? " synthetic" : "")
+            << (isGENIE ? " GENIE" : "") << " events, timing " << nrepeats
+            << " passes of each" << std::endl;
+
+  TH1::AddDirectory(false);
+  HistSet hs(min_pid, max_pid);
+  StageStats nostats;
+
+  size_t nclass[kNumClass + 1] = {0};
+
+  Bench("EventIndex::Build", evts.size(), nrepeats, [&]() {
+    for (auto &evt : evts) {
+      auto &idx = ScratchEventIndex();
+      idx.Build(evt, ToGeV, isGENIE);
+      Sink += idx.final_state.parts.size();
+    }
+  });
+
+  // everything from here on works from prebuilt indices
+  std::vector<EventIndex> idxs(evts.size());
+  std::vector<PDGCounts> counts;
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < evts.size(); ++i) {
+    idxs[i].Build(evts[i], ToGeV, isGENIE);
+    idxs[i].process_id = NuHepMC::ER3::ReadProcessID(evts[i]);
+    counts.push_back(idxs[i].final_state.counts);
+    if (std::find(pclasses.begin(), pclasses.end(),
+                  PrimaryClassification(idxs[i])) != pclasses.end()) {
+      selected.push_back(i);
+    }
+    nclass[PrimaryClassification(idxs[i])]++;
+    nclass[FSClassification(idxs[i])]++;
+  }
+
+  Bench("GetClassification(PDGCounts)", counts.size(), nrepeats, [&]() {
+    for (auto const &c : counts) {
+      Sink += GetClassification(c);
+    }
+  });
+
+  Bench("PrimaryClassification", idxs.size(), nrepeats, [&]() {
+    for (auto const &idx : idxs) {
+      Sink += PrimaryClassification(idx);
+    }
+  });
+
+  Bench("FSClassification", idxs.size(), nrepeats, [&]() {
+    for (auto const &idx : idxs) {
+      Sink += FSClassification(idx);
+    }
+  });
+
+  Bench("GetNeutronNeutralEnergy", idxs.size(), nrepeats, [&]() {
+    for (auto const &idx : idxs) {
+      auto e = GetNeutronNeutralEnergy(idx.FinalState());
+      DSink += e.first + e.second;
+    }
+  });
+
+  if (selected.size()) {
+    Bench("GetPrimaryParticles (selected)", selected.size(), nrepeats, [&]() {
+      for (auto i : selected) {
+        auto pp = GetPrimaryParticles(PrimaryClassification(idxs[i]),
+                                      idxs[i].Primary());
+        Sink += (pp.first != nullptr) + (pp.second != nullptr);
+      }
+    });
+  }
+
+  Bench("ProcessEvent(EventIndex)", idxs.size(), nrepeats, [&]() {
+    for (auto const &idx : idxs) {
+      StageClock clk(nostats);
+      ProcessEvent(idx, hs, clk);
+    }
+  });
+
+  Bench("ProcessEvent(GenEvent)", evts.size(), nrepeats, [&]() {
+    for (auto &evt : evts) {
+      StageClock clk(nostats);
+      ProcessEvent(evt, hs, clk);
+    }
+  });
+
+  // flatten the final state particles to the layout that the batched
+  // classifier consumes, then check it against FSClassification
+  std::vector<int32_t> pids;
+  std::vector<double> Es;
+  std::vector<uint64_t> offsets = {0};
+  std::vector<Classification> expected;
+  for (auto const &idx : idxs) {
+    for (auto const &pt : idx.FinalState()) {
+      pids.push_back(pt.pid);
+      Es.push_back(pt.mom.e());
+    }
+    offsets.push_back(pids.size());
+    expected.push_back(FSClassification(idx));
+  }
+
+  std::vector<Classification> batch(idxs.size());
+  Bench("BatchClassify::Classify", idxs.size(), nrepeats, [&]() {
+    BatchClassify::Classify(pids.data(), Es.data(), nullptr, 0, offsets.data(),
+                            idxs.size(), ToGeV, batch.data());
+  });
+  size_t nmismatch = 0;
+  for (size_t i = 0; i < idxs.size(); ++i) {
+    nmismatch += (batch[i] != expected[i]);
+  }
+  std::cout << "BatchClassify::Classify has " << nmismatch
+            << " mismatches with FSClassification" << std::endl;
+
+  // the whole per-event path including decoding, as nustecana -j 1 runs it
+  Bench("read_event + ProcessEvent", evts.size(), nrepeats, [&]() {
+    auto rdr = HepMC3::deduce_reader(inf);
+    HepMC3::GenEvent evt;
+    for (size_t i = 0; i < evts.size(); ++i) {
+      rdr->read_event(evt);
+      if (rdr->failed()) {
+        break;
+      }
+      StageClock clk(nostats);
+      ProcessEvent(evt, hs, clk);
+    }
+    rdr->close();
+  });
+
+  // the same path with the events indexed straight from the mapped text,
+  // checked against the indices built from the GenEvents
+  if (PrimaryPrefilter::IsAsciiV3(inf)) {
+    FastAsciiReader fast(inf);
+    size_t nfast = std::min(evts.size(), fast.NEvents());
+
+    auto same = [](ParticleList const &a, ParticleList const &b) {
+      if (a.parts.size() != b.parts.size()) {
+        return false;
+      }
+      for (size_t i = 0; i < a.parts.size(); ++i) {
+        auto const &pa = a.parts[i];
+        auto const &pb = b.parts[i];
+        if ((pa.pid != pb.pid) || (pa.status != pb.status) ||
+            (pa.mom.px() != pb.mom.px()) || (pa.mom.py() != pb.mom.py()) ||
+            (pa.mom.pz() != pb.mom.pz()) || (pa.mom.e() != pb.mom.e())) {
+          return false;
+        }
+      }
+      return true;
+    };
+    nmismatch = 0;
+    EventIndex fidx;
+    for (size_t i = 0; i < nfast; ++i) {
+      fast.FillIndex(i, fidx, ToGeV, isGENIE);
+      nmismatch += !same(fidx.primary, idxs[i].primary) ||
+                   !same(fidx.final_state, idxs[i].final_state) ||
+                   (fidx.weights != idxs[i].weights) ||
+                   (fidx.process_id != idxs[i].process_id);
+    }
+    std::cout << "FastAsciiReader::FillIndex has " << nmismatch
+              << " mismatches with EventIndex::Build" << std::endl;
+
+    Bench("FastAsciiReader + ProcessEvent", nfast, nrepeats, [&]() {
+      FastAsciiReader fast(inf);
+      auto &idx = ScratchEventIndex();
+      for (size_t i = 0; i < nfast; ++i) {
+        fast.FillIndex(i, idx, ToGeV, isGENIE);
+        StageClock clk(nostats);
+        ProcessEvent(idx, hs, clk);
+      }
+    });
+  }
+
+  if (!tmpfile.empty()) {
+    std::filesystem::remove(tmpfile);
+  }
+
+  // print something that depends on the results so that the loops are kept
+  std::cout << "Classified (primary + final state):" << std::endl;
+  for (int c = 0; c < kNumClass; ++c) {
+    std::cout << "\t" << Classification(c) << ": " << nclass[c] << std::endl;
+  }
+  std::cout << "(checksum " << Sink << ", " << DSink << ")" << std::endl;
+}
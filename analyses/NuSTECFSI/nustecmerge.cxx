@@ -0,0 +1,111 @@
+// Leave this at the top to enable features detected at build time in headers in
+// HepMC3
+#include "NuHepMC/HepMC3Features.hxx"
+
+#include "commonana.hxx"
+#include "merge.hxx"
+#include "provenance.hxx"
+
+#include "TFile.h"
+#include "TH1.h"
+
+#include <cstdio>
+#include <iostream>
+
+// Sums the outputs of nustecana runs over different slices of the same input,
+// e.g. the shards of a --shard i/N batch submission. Histograms are summed in
+// the order the inputs are given. The transparency ratios and smoothed
+// histograms are not summed, they are rebuilt from the summed numerators,
+// denominators and unsmoothed histograms exactly as nustecana writes them.
+int main(int argc, char const *argv[]) {
+
+  TH1::SetDefaultSumw2(true);
+  TH1::AddDirectory(false);
+
+  std::string dir;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "--dir") && ((i + 1) < argc)) {
+      dir = argv[++i];
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (posargs.size() < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [--dir <dir>] <outfile.root> <shard.root> [shard.root ...]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string out = posargs[0];
+  std::vector<std::string> infs(posargs.begin() + 1, posargs.end());
+
+  SetupDerived();
+
+  std::vector<std::unique_ptr<TFile>> fins;
+  std::vector<TDirectory *> ins;
+  for (auto const &inf : infs) {
+    fins.emplace_back(TFile::Open(inf.c_str(), "READ"));
+    if (!fins.back() || fins.back()->IsZombie()) {
+      std::cout << "Failed to open " << inf << std::endl;
+      return 1;
+    }
+
+    ins.push_back(fins.back().get());
+    if (dir.length()) {
+      ins.back() = fins.back()->GetDirectory(dir.c_str());
+      if (!ins.back()) {
+        std::cout << inf << " has no directory " << dir << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // the inputs of every input are carried over, the same events must not
+  // be summed twice. The runs that wrote the inputs do not hash their own
+  // inputs, each distinct one is hashed here once, however many shards of it
+  // there are.
+  std::vector<InputRecord> provenance;
+  std::vector<size_t> from;
+  for (size_t i = 0; i < ins.size(); ++i) {
+    for (auto const &r : ReadProvenance(ins[i])) {
+      provenance.push_back(r);
+      from.push_back(i);
+    }
+  }
+  ResolveHashes(provenance, HashMemo(HashMemo::DefaultDir()));
+  for (size_t i = 0; i < provenance.size(); ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      auto const &r = provenance[i], &p = provenance[j];
+      if (p.Overlaps(r)) {
+        std::cout << infs[from[i]] << " contains " << r.Events() << " of "
+                  << r.path << ", which overlap " << p.Events() << " of "
+                  << p.path << " in " << infs[from[j]] << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  TFile fout(out.c_str(), "RECREATE");
+
+  TDirectory *dout = &fout;
+  if (dir.length()) {
+    dout = fout.mkdir(dir.c_str());
+  }
+
+  // a failed merge leaves no output behind
+  if (!MergeDirectory(infs, ins, dout)) {
+    fout.Close();
+    std::remove(out.c_str());
+    return 1;
+  }
+  if (provenance.size()) {
+    WriteProvenance(dout, provenance);
+  }
+
+  std::cout << "Merged " << infs.size() << " inputs into " << out
+            << std::endl;
+}
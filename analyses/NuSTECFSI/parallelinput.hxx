@@ -0,0 +1,526 @@
+#pragma once
+
+#include "eventqueue.hxx"
+
+#include "HepMC3/ReaderAscii.h"
+
+#include <bzlib.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Codec { kNone, kGzip, kBzip2, kXz };
+
+inline Codec DetectCodec(std::string const &fname) {
+  std::ifstream ifs(fname, std::ios::binary);
+  unsigned char m[6] = {0};
+  ifs.read(reinterpret_cast<char *>(m), 6);
+  if ((m[0] == 0x1f) && (m[1] == 0x8b)) {
+    return Codec::kGzip;
+  }
+  if ((m[0] == 'B') && (m[1] == 'Z') && (m[2] == 'h')) {
+    return Codec::kBzip2;
+  }
+  if (!std::memcmp(m, "\xFD" "7zXZ\0", 6)) {
+    return Codec::kXz;
+  }
+  return Codec::kNone;
+}
+
+// Incremental decoder of gzip, bzip2 or xz data. Concatenated gzip members
+// and bzip2 streams are decoded one after the other, as gzip -d and bzip2 -d
+// do. xz streams are decoded with liblzma's multithreaded decoder where it is
+// available, which decodes the blocks of multi-block files in parallel.
+class Decoder {
+  Codec codec;
+  uint32_t nthreads;
+  z_stream z;
+  bz_stream bz;
+  lzma_stream xz = LZMA_STREAM_INIT;
+  // in the middle of a gzip member or bzip2 stream, or of the xz input
+  bool active = false;
+  // the end of the xz input, which may hold several streams, has been seen
+  bool xz_done = false;
+
+  static constexpr size_t kOutStep = 1 << 18;
+
+  void Begin() {
+    bool ok = false;
+    if (codec == Codec::kGzip) {
+      std::memset(&z, 0, sizeof(z));
+      // 32 enables gzip header detection
+      ok = inflateInit2(&z, 15 + 32) == Z_OK;
+    } else if (codec == Codec::kBzip2) {
+      std::memset(&bz, 0, sizeof(bz));
+      ok = BZ2_bzDecompressInit(&bz, 0, 0) == BZ_OK;
+    } else if (codec == Codec::kXz) {
+#if LZMA_VERSION >= 50040002
+      lzma_mt mt;
+      std::memset(&mt, 0, sizeof(mt));
+      mt.flags = LZMA_CONCATENATED;
+      mt.threads = nthreads;
+      mt.memlimit_threading = lzma_physmem() / 4;
+      mt.memlimit_stop = UINT64_MAX;
+      ok = lzma_stream_decoder_mt(&xz, &mt) == LZMA_OK;
+#else
+      ok = lzma_stream_decoder(&xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+#endif
+    }
+    if (!ok) {
+      throw std::runtime_error("Failed to initialise the decoder");
+    }
+    active = true;
+  }
+
+  void End() {
+    if (!active) {
+      return;
+    }
+    if (codec == Codec::kGzip) {
+      inflateEnd(&z);
+    } else if (codec == Codec::kBzip2) {
+      BZ2_bzDecompressEnd(&bz);
+    } else if (codec == Codec::kXz) {
+      lzma_end(&xz);
+    }
+    active = false;
+  }
+
+public:
+  Decoder(Codec codec_, uint32_t nthreads_ = 1)
+      : codec(codec_), nthreads(std::max(uint32_t(1), nthreads_)) {}
+  ~Decoder() { End(); }
+
+  // Decodes all of [in, in + nin) and appends the output to out. finish
+  // signals the end of the input, after which no member may be left open.
+  void Decode(char const *in, size_t nin, std::string &out, bool finish) {
+    while (true) {
+      if (!active) {
+        // a new member starts wherever the last one ended, xz handles
+        // concatenated streams itself
+        if (!nin || xz_done) {
+          break;
+        }
+        Begin();
+      }
+
+      size_t n = out.size();
+      out.resize(n + kOutStep);
+      char *o = &out[n];
+      size_t nused = 0, nout = 0;
+      bool member_end = false;
+
+      if (codec == Codec::kGzip) {
+        z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+        z.avail_in = uInt(nin);
+        z.next_out = reinterpret_cast<Bytef *>(o);
+        z.avail_out = uInt(kOutStep);
+        int rc = inflate(&z, Z_NO_FLUSH);
+        if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR)) {
+          throw std::runtime_error(std::string("gzip: ") +
+                                   (z.msg ? z.msg : "corrupt input"));
+        }
+        nused = nin - z.avail_in;
+        nout = kOutStep - z.avail_out;
+        member_end = rc == Z_STREAM_END;
+      } else if (codec == Codec::kBzip2) {
+        bz.next_in = const_cast<char *>(in);
+        bz.avail_in = unsigned(nin);
+        bz.next_out = o;
+        bz.avail_out = unsigned(kOutStep);
+        int rc = BZ2_bzDecompress(&bz);
+        if ((rc != BZ_OK) && (rc != BZ_STREAM_END)) {
+          throw std::runtime_error("bzip2: corrupt input (" +
+                                   std::to_string(rc) + ")");
+        }
+        nused = nin - bz.avail_in;
+        nout = kOutStep - bz.avail_out;
+        member_end = rc == BZ_STREAM_END;
+      } else {
+        xz.next_in = reinterpret_cast<uint8_t const *>(in);
+        xz.avail_in = nin;
+        xz.next_out = reinterpret_cast<uint8_t *>(o);
+        xz.avail_out = kOutStep;
+        lzma_ret rc = lzma_code(&xz, finish ? LZMA_FINISH : LZMA_RUN);
+        if ((rc != LZMA_OK) && (rc != LZMA_STREAM_END) &&
+            (rc != LZMA_BUF_ERROR)) {
+          throw std::runtime_error("xz: corrupt input (" + std::to_string(rc) +
+                                   ")");
+        }
+        nused = nin - xz.avail_in;
+        nout = kOutStep - xz.avail_out;
+        member_end = rc == LZMA_STREAM_END;
+      }
+
+      out.resize(n + nout);
+      in += nused;
+      nin -= nused;
+      if (member_end) {
+        End();
+        xz_done = codec == Codec::kXz;
+        continue;
+      }
+      // out of input, or out of input to finish with
+      if (!nused && !nout) {
+        if (nin && !finish) {
+          throw std::runtime_error("Decoder made no progress");
+        }
+        break;
+      }
+      // at the end of the input the xz decoder is only done once it reports
+      // the end of the stream
+      if (!nin && (nout < kOutStep) && !(finish && (codec == Codec::kXz))) {
+        break;
+      }
+    }
+    if (finish && active) {
+      throw std::runtime_error("Unexpected end of compressed input");
+    }
+  }
+};
+
+// Runs f over a sequence of inputs on nthreads threads and hands the results
+// back in the order in which the inputs were submitted. Exceptions thrown by
+// f are rethrown from Next.
+class OrderedWorkers {
+  struct Job {
+    std::string in;
+    std::promise<std::string> out;
+  };
+
+  std::function<std::string(std::string const &)> f;
+  BoundedQueue<std::unique_ptr<Job>> jobs;
+  std::deque<std::future<std::string>> results;
+  std::vector<std::thread> threads;
+
+public:
+  OrderedWorkers(size_t nthreads,
+                 std::function<std::string(std::string const &)> f_)
+      : f(f_), jobs(2 * nthreads) {
+    for (size_t t = 0; t < nthreads; ++t) {
+      threads.emplace_back([this]() {
+        std::unique_ptr<Job> job;
+        while (jobs.pop(job)) {
+          try {
+            job->out.set_value(f(job->in));
+          } catch (...) {
+            job->out.set_exception(std::current_exception());
+          }
+        }
+      });
+    }
+  }
+  ~OrderedWorkers() {
+    jobs.close();
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  // the number of inputs whose results have not been taken with Next
+  size_t InFlight() const { return results.size(); }
+
+  void Submit(std::string in) {
+    auto job = std::make_unique<Job>();
+    job->in = std::move(in);
+    results.push_back(job->out.get_future());
+    jobs.push(std::move(job));
+  }
+
+  // waits for the result of the oldest input, false if there is none
+  bool Next(std::string &out) {
+    if (results.empty()) {
+      return false;
+    }
+    auto res = std::move(results.front());
+    results.pop_front();
+    out = res.get();
+    return true;
+  }
+};
+
+// Decompresses a gzip, bzip2 or xz file into an ordered byte stream, on
+// several threads where the layout of the file allows it:
+//  - BGZF files (bgzip, or recompress), whose gzip members record their own
+//    size, are cut into runs of whole members.
+//  - Multi-stream bzip2 files (pbzip2, or recompress) are cut at the starts
+//    of streams, found by their byte-aligned stream and block magic.
+//  - Multi-block xz files (xz -T, or recompress) are handed to liblzma's
+//    multithreaded decoder.
+// Runs of members are decoded independently on a pool of threads, a few
+// ahead of the reader, and concatenated in file order. Any other compressed
+// file is decoded on the calling thread.
+class ParallelDecompressor : public std::streambuf {
+  std::string fname;
+  std::ifstream in;
+  Codec codec;
+  bool split;
+  std::string failure;
+
+  // bytes read from the file but not yet submitted
+  std::string pending;
+  size_t scanned = 0;
+  bool in_eof = false;
+
+  size_t nthreads;
+  std::unique_ptr<Decoder> serial;
+  std::unique_ptr<OrderedWorkers> workers;
+
+  // the decompressed text currently exposed to the reader
+  std::string chunk;
+
+  // aim for units of at least this much compressed input
+  static constexpr size_t kUnitSize = 1 << 20;
+  static constexpr size_t kReadSize = 1 << 20;
+
+  bool ReadMore() {
+    if (in_eof) {
+      return false;
+    }
+    size_t n = pending.size();
+    pending.resize(n + kReadSize);
+    in.read(&pending[n], kReadSize);
+    pending.resize(n + size_t(in.gcount()));
+    in_eof = !in;
+    return pending.size() > n;
+  }
+
+  // the offset of the first bzip2 stream header at or after from
+  static size_t FindBzip2Stream(std::string const &buf, size_t from) {
+    static char const magic[] = "1AY&SY";
+    for (size_t p = buf.find("BZh", from); p != std::string::npos;
+         p = buf.find("BZh", p + 1)) {
+      if ((p + 10) > buf.size()) {
+        return std::string::npos;
+      }
+      if ((buf[p + 3] >= '1') && (buf[p + 3] <= '9') &&
+          !std::memcmp(&buf[p + 4], magic, 6)) {
+        return p;
+      }
+    }
+    return std::string::npos;
+  }
+
+  // the total size of the BGZF member at the start of buf, 0 if buf does not
+  // hold its header yet, throws if it is not a BGZF member
+  static size_t BGZFMemberSize(char const *buf, size_t n) {
+    if (n < 12) {
+      return 0;
+    }
+    auto b = reinterpret_cast<unsigned char const *>(buf);
+    if ((b[0] != 0x1f) || (b[1] != 0x8b) || !(b[3] & 4)) {
+      throw std::runtime_error("gzip member without BGZF block size");
+    }
+    size_t xlen = b[10] | (b[11] << 8);
+    if (n < (12 + xlen)) {
+      return 0;
+    }
+    for (size_t p = 12; (p + 4) <= (12 + xlen);) {
+      size_t slen = b[p + 2] | (b[p + 3] << 8);
+      if ((b[p] == 'B') && (b[p + 1] == 'C') && (slen == 2)) {
+        return (b[p + 4] | (b[p + 5] << 8)) + 1;
+      }
+      p += 4 + slen;
+    }
+    throw std::runtime_error("gzip member without BGZF block size");
+  }
+
+  // cuts the next run of whole members from the input
+  bool NextUnit(std::string &unit) {
+    if (codec == Codec::kGzip) {
+      size_t end = 0;
+      while (end < kUnitSize) {
+        size_t size =
+            BGZFMemberSize(pending.data() + end, pending.size() - end);
+        if (size && ((end + size) <= pending.size())) {
+          end += size;
+        } else if (!ReadMore()) {
+          if (end != pending.size()) {
+            throw std::runtime_error("Truncated BGZF member");
+          }
+          break;
+        }
+      }
+      unit = pending.substr(0, end);
+      pending.erase(0, end);
+      return unit.size();
+    }
+
+    // a bzip2 unit ends where the first stream starting beyond kUnitSize
+    // begins
+    while (true) {
+      if (pending.size() > kUnitSize) {
+        size_t p = FindBzip2Stream(pending, std::max(scanned, kUnitSize));
+        if (p != std::string::npos) {
+          unit = pending.substr(0, p);
+          pending.erase(0, p);
+          scanned = 0;
+          return true;
+        }
+        // a header may straddle the end of what has been read
+        scanned = pending.size() - std::min(pending.size(), size_t(9));
+      }
+      if (!ReadMore()) {
+        unit = std::move(pending);
+        pending.clear();
+        return unit.size();
+      }
+    }
+  }
+
+  // fills chunk with the next decompressed text, false at the end
+  bool Load() {
+    chunk.clear();
+    if (!split) {
+      while (chunk.empty()) {
+        bool more = ReadMore();
+        serial->Decode(pending.data(), pending.size(), chunk, !more);
+        pending.clear();
+        if (!more) {
+          break;
+        }
+      }
+      return chunk.size();
+    }
+
+    while (chunk.empty()) {
+      std::string unit;
+      while ((workers->InFlight() < (2 * nthreads)) && NextUnit(unit)) {
+        workers->Submit(std::move(unit));
+        unit.clear();
+      }
+      if (!workers->Next(chunk)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    try {
+      if (failure.size() || !Load()) {
+        return traits_type::eof();
+      }
+    } catch (std::exception const &e) {
+      failure = e.what();
+      std::cout << "Failed to decompress " << fname << ": " << failure
+                << std::endl;
+      return traits_type::eof();
+    }
+    setg(&chunk[0], &chunk[0], &chunk[0] + chunk.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  ParallelDecompressor(std::string const &fname_, size_t nthreads_)
+      : fname(fname_), in(fname_, std::ios::binary),
+        codec(DetectCodec(fname_)), split(false),
+        nthreads(std::max(size_t(1), nthreads_)) {
+    if (codec == Codec::kNone) {
+      throw std::runtime_error(fname + " is not gzip, bzip2 or xz compressed");
+    }
+
+    // probe the start of the file for a layout that can be split
+    if (nthreads > 1) {
+      ReadMore();
+      if (codec == Codec::kGzip) {
+        try {
+          split = BGZFMemberSize(pending.data(), pending.size()) != 0;
+        } catch (std::exception const &) {
+        }
+      } else if (codec == Codec::kBzip2) {
+        while ((pending.size() < (32 * kUnitSize)) && ReadMore()) {
+        }
+        split = FindBzip2Stream(pending, 1) != std::string::npos;
+      }
+    }
+
+    if (split) {
+      Codec c = codec;
+      workers = std::make_unique<OrderedWorkers>(
+          nthreads, [c](std::string const &unit) {
+            Decoder d(c);
+            std::string out;
+            out.reserve(unit.size() * 4);
+            d.Decode(unit.data(), unit.size(), out, true);
+            return out;
+          });
+    } else {
+      serial = std::make_unique<Decoder>(codec, uint32_t(nthreads));
+    }
+  }
+
+  // true if decompression stopped early because the input was corrupt
+  bool Failed() const { return failure.size(); }
+
+  bool Parallel() const { return split || (codec == Codec::kXz); }
+
+  // the first n bytes of the decompressed file
+  static std::string Head(std::string const &fname, size_t n) {
+    std::ifstream ifs(fname, std::ios::binary);
+    Decoder d(DetectCodec(fname));
+    std::string buf(kReadSize, '\0'), out;
+    try {
+      while ((out.size() < n) && ifs.read(&buf[0], kReadSize).gcount()) {
+        d.Decode(buf.data(), size_t(ifs.gcount()), out, false);
+      }
+    } catch (std::exception const &) {
+    }
+    return out.substr(0, n);
+  }
+};
+
+struct ParallelDecompressorStream {
+  ParallelDecompressor buf;
+  std::istream is;
+
+  ParallelDecompressorStream(std::string const &fname, size_t nthreads)
+      : buf(fname, nthreads), is(&buf) {}
+};
+
+// A HepMC3::ReaderAscii of a compressed file that is decompressed by a
+// ParallelDecompressor
+class ParallelReaderAscii : private ParallelDecompressorStream,
+                            public HepMC3::ReaderAscii {
+public:
+  ParallelReaderAscii(std::string const &fname, size_t nthreads)
+      : ParallelDecompressorStream(fname, nthreads), HepMC3::ReaderAscii(is) {}
+
+  // true if fname is gzip, bzip2 or xz compressed HepMC3 ASCII
+  static bool IsSupported(std::string const &fname) {
+    if (DetectCodec(fname) == Codec::kNone) {
+      return false;
+    }
+    std::istringstream head(ParallelDecompressor::Head(fname, 4096));
+    std::string l;
+    while (std::getline(head, l)) {
+      if (l.rfind("HepMC::Version", 0) == 0) {
+        continue;
+      }
+      return l.rfind("HepMC::Asciiv3-START_EVENT_LISTING", 0) == 0;
+    }
+    return false;
+  }
+
+  bool DecompressionFailed() const { return buf.Failed(); }
+  bool Parallel() const { return buf.Parallel(); }
+};
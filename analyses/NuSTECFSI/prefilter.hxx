@@ -0,0 +1,233 @@
+#pragma once
+
+#include "commonana.hxx"
+
+#include "NuHepMC/Constants.hxx"
+
+#include "HepMC3/GenEvent.h"
+#include "HepMC3/ReaderAscii.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Pre-filters a HepMC3 ASCII (Asciiv3) file on the topology of its primary
+// particles. Each event record is scanned line by line and only the fields
+// needed to count the particles leaving the primary vertex (or for GENIE the
+// status 26 particles and the primary leptons) are parsed, exactly as
+// EventIndex::Build selects them. Events whose primary topology is not
+// accepted are dropped without ever being materialised as a GenEvent, the
+// records of accepted events are handed unchanged to a HepMC3::ReaderAscii.
+//
+// This sits between the file and the ReaderAscii as a streambuf. The reader
+// peeks at the start of the next record after finishing an event, so the
+// next accepted event has always been found by the time read_event returns.
+class PrimaryPrefilter : public std::streambuf {
+public:
+  static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+private:
+  std::ifstream in;
+  // the next line of the input that has not been consumed
+  std::string line;
+  bool have_line = false;
+
+  double ToGeV;
+  bool isGENIE;
+  std::vector<Classification> accept;
+
+  size_t nmax;
+  size_t nscanned = 0;
+  bool footer_sent = false;
+
+  // the text currently exposed to the reader
+  std::string chunk;
+  // indices of the accepted events in chunk that the reader has not yet
+  // finished, counted from the first event after those skipped
+  std::deque<size_t> ordinals;
+
+  bool NextLine() {
+    have_line = bool(std::getline(in, line));
+    return have_line;
+  }
+
+  // moves to the E line that starts the next event, returns false at the end
+  // of the input
+  bool Seek() {
+    while (have_line && (line[0] != 'E')) {
+      NextLine();
+    }
+    return have_line;
+  }
+
+  bool EndOfEvent() {
+    return !NextLine() || (line[0] == 'E') || (line[0] == 'H');
+  }
+
+  // appends the record of the event that starts on the current line to out and
+  // returns whether its primary topology is accepted
+  bool Scan(std::string &out) {
+    PDGCounts counts;
+    long primary_vtx = 0;
+    do {
+      out += line;
+      out += '\n';
+
+      char const *c = line.c_str();
+      char *e = nullptr;
+      if ((c[0] == 'V') && !primary_vtx) {
+        long id = std::strtol(c + 1, &e, 10);
+        if (std::strtol(e, nullptr, 10) == NuHepMC::VertexStatus::Primary) {
+          primary_vtx = id;
+        }
+      } else if (c[0] == 'P') {
+        // P id parent pid px py pz e m status
+        std::strtol(c + 1, &e, 10);
+        long parent = std::strtol(e, &e, 10);
+        int pid = int(std::strtol(e, &e, 10));
+
+        bool from_primary = primary_vtx && (parent == primary_vtx);
+        int n = 0;
+        if (isGENIE) {
+          if (std::atoi(std::strrchr(c, ' ') + 1) == 26) {
+            n++;
+          }
+          n += (from_primary && (std::abs(pid) >= 11) && (std::abs(pid) <= 16));
+        } else {
+          n += from_primary;
+        }
+
+        // the energy is only used to decide whether gammas are counted
+        double E = 0;
+        if (n && (pid == 22)) {
+          for (int i = 0; i < 4; ++i) {
+            E = std::strtod(e, &e);
+          }
+        }
+        for (int i = 0; i < n; ++i) {
+          counts.add(pid, E * ToGeV);
+        }
+      }
+    } while (!EndOfEvent());
+
+    return std::find(accept.begin(), accept.end(), GetClassification(counts)) !=
+           accept.end();
+  }
+
+  // replaces chunk with the record of the next accepted event, or with the end
+  // of listing line once the input or the range is exhausted
+  bool Load() {
+    while ((nscanned < nmax) && Seek()) {
+      size_t n = chunk.size();
+      bool passed = Scan(chunk);
+      nscanned++;
+      if (passed) {
+        ordinals.push_back(nscanned - 1);
+        return true;
+      }
+      chunk.resize(n);
+    }
+    if (!footer_sent) {
+      chunk += "HepMC::Asciiv3-END_EVENT_LISTING\n";
+      footer_sent = true;
+    }
+    return chunk.size();
+  }
+
+protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    chunk.clear();
+    if (!Load()) {
+      return traits_type::eof();
+    }
+    setg(&chunk[0], &chunk[0], &chunk[0] + chunk.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  // skips the first skip events of the file and then considers at most
+  // nevents events
+  PrimaryPrefilter(std::string const &fname, double ToGeV_, bool isGENIE_,
+                   std::vector<Classification> const &accept_, size_t skip,
+                   size_t nevents)
+      : in(fname), ToGeV(ToGeV_), isGENIE(isGENIE_), accept(accept_),
+        nmax(nevents) {
+
+    // the header lines are passed through in front of the first event
+    NextLine();
+    while (have_line && (line[0] != 'E')) {
+      chunk += line;
+      chunk += '\n';
+      NextLine();
+    }
+
+    for (size_t i = 0; (i < skip) && Seek(); ++i) {
+      while (!EndOfEvent()) {
+      }
+    }
+
+    Load();
+    setg(&chunk[0], &chunk[0], &chunk[0] + chunk.size());
+  }
+
+  // true if fname is an uncompressed HepMC3 ASCII file
+  static bool IsAsciiV3(std::string const &fname) {
+    std::ifstream ifs(fname);
+    std::string l;
+    while (std::getline(ifs, l)) {
+      if (l.rfind("HepMC::Version", 0) == 0) {
+        continue;
+      }
+      return l.rfind("HepMC::Asciiv3-START_EVENT_LISTING", 0) == 0;
+    }
+    return false;
+  }
+
+  // the index of the event that the reader will return next, npos if there
+  // are no more accepted events
+  size_t Next() const { return ordinals.empty() ? npos : ordinals.front(); }
+  void Pop() {
+    if (ordinals.size()) {
+      ordinals.pop_front();
+    }
+  }
+
+  // the number of events considered so far, accepted or not
+  size_t NScanned() const { return nscanned; }
+};
+
+// reads only the events accepted by a PrimaryPrefilter
+class PrefilterReader {
+  PrimaryPrefilter buf;
+  std::istream is;
+  HepMC3::ReaderAscii rdr;
+
+public:
+  PrefilterReader(std::string const &fname, double ToGeV, bool isGENIE,
+                  std::vector<Classification> const &accept, size_t skip,
+                  size_t nevents)
+      : buf(fname, ToGeV, isGENIE, accept, skip, nevents), is(&buf),
+        rdr(is) {}
+
+  static bool IsSupported(std::string const &fname) {
+    return PrimaryPrefilter::IsAsciiV3(fname);
+  }
+
+  size_t Next() const { return buf.Next(); }
+  size_t NScanned() const { return buf.NScanned(); }
+
+  bool read_event(HepMC3::GenEvent &evt) {
+    rdr.read_event(evt);
+    buf.Pop();
+    return !rdr.failed();
+  }
+};
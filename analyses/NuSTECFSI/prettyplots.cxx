@@ -1,4 +1,6 @@
 #include "commonana.hxx"
+#include "projection.hxx"
+#include "reshape.hxx"
 
 #include "TCanvas.h"
 #include "TFile.h"
@@ -6,682 +8,1035 @@
 #include "TH3D.h"
 #include "TLatex.h"
 #include "TLegend.h"
+#include "TNamed.h"
 #include "TPad.h"
+#include "TROOT.h"
 #include "TStyle.h"
 
 #include "fmt/core.h"
 
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 bool reshape = true;
 
-struct THBlob {
-  std::unique_ptr<TH2D> PrimaryToFinalStateSmearing;
+// Derived histograms of one input file cached in <input>.ppcache.root next to
+// it. Each entry is keyed by everything that it was derived from, so samples
+// reshaped to different references do not collide, and the whole cache is
+// replaced when the input file or Version changes. Access is serialised with
+// an flock on the input file as pages may be rendered by several processes at
+// once.
+class ProjectionCache {
+  // bump whenever the way that the projections are derived changes, so that
+  // caches written by older builds are rebuilt rather than served
+  static constexpr int Version = 2;
+
+  std::string input;
+  std::string fname;
+  std::string input_id;
+
+  // holds a lock on the input file until destroyed
+  struct Lock {
+    int fd;
+    Lock(std::string const &f, int op) : fd(open(f.c_str(), O_RDONLY)) {
+      if (fd >= 0) {
+        flock(fd, op);
+      }
+    }
+    ~Lock() {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  };
 
-  std::unique_ptr<TH1D> PreFSIKinematics_1p;
+  static std::string EntryName(std::string const &key) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+      h = (h ^ c) * 1099511628211ULL;
+    }
+    return fmt::format("h{:016x}", h);
+  }
 
-  std::unique_ptr<TH2D> TotalNeutronKE_1p_only;
+  // true if fname exists and was derived from the current input
+  bool Current() const {
+    if (!std::filesystem::exists(fname)) {
+      return false;
+    }
+    TFile fin(fname.c_str(), "READ");
+    if (fin.IsZombie()) {
+      return false;
+    }
+    std::unique_ptr<TNamed> src(fin.Get<TNamed>("input"));
+    return src && (input_id == src->GetTitle());
+  }
 
-  std::unique_ptr<TH2D> PreFSIKinematics_1piplus_1p;
+public:
+  // identifies a version of a file by its path, size and modification time
+  static std::string FileId(std::string const &f) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(f, ec);
+    auto mtime = std::filesystem::last_write_time(f, ec);
+    return fmt::format("{}:{}:{}", f, size, mtime.time_since_epoch().count());
+  }
 
-  std::unique_ptr<TH3D> TotalPi0E_1piplus_1p;
-  std::unique_ptr<TH3D> TotalNeutralE_1piplus_1p;
+  ProjectionCache(std::string const &input_)
+      : input(input_), fname(input_ + ".ppcache.root"),
+        input_id(fmt::format("v{} {}", Version, FileId(input_))) {}
 
-  std::unique_ptr<TH1D> Transparency_1p_only;
-  std::unique_ptr<TH1D> Transparency_1piplus_1p;
+  // the histogram cached for key, nullptr if there is none
+  std::unique_ptr<TH1D> Get(std::string const &key) const {
+    Lock lock(input, LOCK_SH);
+    if (!Current()) {
+      return nullptr;
+    }
+    TFile fin(fname.c_str(), "READ");
+    std::unique_ptr<TH1D> h(fin.Get<TH1D>(EntryName(key).c_str()));
+    if (h) {
+      h->SetDirectory(nullptr);
+    }
+    return h;
+  }
 
-  std::unique_ptr<TH1D> TotalNeutronKE_1p_only_belowcut;
-  std::unique_ptr<TH1D> TotalNeutronKE_1p_only_abovecut;
+  // failing to write the cache, e.g. next to a read-only input, is not an
+  // error, the histogram is just derived again next time
+  void Put(std::string const &key, TH1D const &h) const {
+    Lock lock(input, LOCK_EX);
+    bool current = Current();
+    TFile fout(fname.c_str(), current ? "UPDATE" : "RECREATE");
+    if (fout.IsZombie()) {
+      return;
+    }
+    if (!current) {
+      TNamed("input", input_id.c_str()).Write();
+    }
+    fout.WriteObject(&h, EntryName(key).c_str(), "Overwrite");
+  }
+};
 
-  std::unique_ptr<TH1D> TotalPi0E_1piplus_1p_belowcut;
-  std::unique_ptr<TH1D> TotalPi0E_1piplus_1p_abovecut;
-  std::unique_ptr<TH1D> TotalNeutralE_1piplus_1p_belowcut;
-  std::unique_ptr<TH1D> TotalNeutralE_1piplus_1p_abovecut;
+// The histograms of one nustecana output, each read from the file the first
+// time that it is used. Only the projections that are drawn are derived and
+// those come from the ProjectionCache when it has them, so that the large 3D
+// histograms are not read at all on repeat runs.
+//
+// Samples other than the reference are reshaped to the reference's preFSI
+// kinematics and their projections are normalised to the reference.
+class THBlob {
+  std::string fin_name;
+  ProjectionCache cache;
+
+  std::map<std::string, std::unique_ptr<TH1>> hists;
+  std::map<std::string, std::unique_ptr<ShapeReweight>> shapes;
+  std::map<std::string, std::unique_ptr<TH1D>> projections;
+
+  // other samples read the reference's histograms while they are loaded
+  // concurrently, those reads go through RefLoad and RefNorm
+  std::unique_ptr<std::mutex> ref_mutex = std::make_unique<std::mutex>();
+
+  template <typename T> T *Load(std::string const &name) {
+    auto &h = hists[name];
+    if (!h) {
+      TFile fin(fin_name.c_str(), "READ");
+      h.reset(fin.Get<T>(name.c_str()));
+      if (!h) {
+        throw std::runtime_error("Failed to read " + name + " from " +
+                                 fin_name);
+      }
+      h->SetDirectory(nullptr);
+    }
+    return static_cast<T *>(h.get());
+  }
 
-  THBlob(std::string const &fin_name, THBlob const *other) {
-    TFile fin(fin_name.c_str(), "READ");
+  // the preFSI kinematics shape that each reshaped histogram is binned in
+  ShapeReweight const &Shape(std::string const &source) {
+    std::string kin = (source == "TotalNeutronKE_1p_only")
+                          ? "PreFSIKinematics_1p"
+                          : "PreFSIKinematics_1piplus_1p";
+    auto &s = shapes[kin];
+    if (!s) {
+      if (kin == "PreFSIKinematics_1p") {
+        s = std::make_unique<ShapeReweight>(*reference->RefLoad<TH1D>(kin),
+                                            *Load<TH1D>(kin));
+      } else {
+        s = std::make_unique<ShapeReweight>(*reference->RefLoad<TH2D>(kin),
+                                            *Load<TH2D>(kin));
+      }
+    }
+    return *s;
+  }
 
-    PrimaryToFinalStateSmearing =
-        std::unique_ptr<TH2D>(fin.Get<TH2D>("PrimaryToFinalStateSmearing"));
-    PrimaryToFinalStateSmearing->SetDirectory(nullptr);
-    RowNormTH2(PrimaryToFinalStateSmearing.get());
+  // a 2D or 3D histogram binned in the preFSI kinematics, reshaped to the
+  // reference when it is first read
+  TH1 *Source(std::string const &name) {
+    bool loaded = hists.count(name);
+    TH1 *h = Load<TH1>(name);
+    if (!loaded && reference && reshape) {
+      if (auto h2 = dynamic_cast<TH2D *>(h)) {
+        Shape(name).Apply(*h2);
+      } else if (auto h3 = dynamic_cast<TH3D *>(h)) {
+        Shape(name).Apply(*h3);
+      }
+    }
+    return h;
+  }
 
-    PreFSIKinematics_1p =
-        std::unique_ptr<TH1D>(fin.Get<TH1D>("PreFSIKinematics_1p"));
-    PreFSIKinematics_1p->SetDirectory(nullptr);
+  template <typename T> T *RefLoad(std::string const &name) {
+    std::lock_guard<std::mutex> lock(*ref_mutex);
+    return Load<T>(name);
+  }
+  double RefNorm(std::string const &source) {
+    std::lock_guard<std::mutex> lock(*ref_mutex);
+    return Source(source)->Integral();
+  }
 
-    PreFSIKinematics_1piplus_1p =
-        std::unique_ptr<TH2D>(fin.Get<TH2D>("PreFSIKinematics_1piplus_1p"));
-    PreFSIKinematics_1piplus_1p->SetDirectory(nullptr);
+  // the projections that the pages draw and the histograms they are taken of
+  struct Derived {
+    std::string source;
+    XSlice slice;
+  };
+  static std::vector<Derived> const &DerivedHists() {
+    static std::vector<Derived> const derived = {
+        {"TotalNeutronKE_1p_only",
+         {"TotalNeutronKE_1p_only_belowcut", 2, 11, 0, 0, 1}},
+        {"TotalNeutronKE_1p_only",
+         {"TotalNeutronKE_1p_only_abovecut", 12, 51, 0, 0, 4}},
+        {"TotalPi0E_1piplus_1p",
+         {"TotalPi0E_1piplus_1p_belowcut", 2, 51, 2, 16, 1}},
+        {"TotalPi0E_1piplus_1p",
+         {"TotalPi0E_1piplus_1p_abovecut", 2, 51, 17, 31, 4}},
+        {"TotalNeutralE_1piplus_1p",
+         {"TotalNeutralE_1piplus_1p_belowcut", 2, 51, 2, 16, 1}},
+        {"TotalNeutralE_1piplus_1p",
+         {"TotalNeutralE_1piplus_1p_abovecut", 2, 51, 17, 31, 4}},
+    };
+    return derived;
+  }
 
-    TotalNeutronKE_1p_only =
-        std::unique_ptr<TH2D>(fin.Get<TH2D>("TotalNeutronKE_1p_only"));
-    TotalNeutronKE_1p_only->SetDirectory(nullptr);
+  std::string CacheKey(Derived const &d) const {
+    return fmt::format(
+        "{} y[{},{}] z[{},{}] rebin {} norm {}{}", d.source, d.slice.y1,
+        d.slice.y2, d.slice.z1, d.slice.z2, d.slice.rebin,
+        reference ? ProjectionCache::FileId(reference->fin_name) : "",
+        (reference && reshape) ? " reshaped" : "");
+  }
 
-    if (other && reshape) {
-      // reweight each row by the relevant preFSI kinematics shape.
+  // A derived projection, normalised to the integral of the reference's
+  // source per original bin. Every projection of the same source that is not
+  // in the cache is made in the same pass over the source.
+  TH1D *Projection(std::string const &name) {
+    auto d = std::find_if(
+        DerivedHists().begin(), DerivedHists().end(),
+        [&](Derived const &d) { return d.slice.name == name; });
+    if (d == DerivedHists().end()) {
+      throw std::runtime_error("No projection named " + name);
+    }
+    if (projections[name]) {
+      return projections[name].get();
+    }
 
-      for (int i = 0; i < PreFSIKinematics_1p->GetXaxis()->GetNbins(); ++i) {
-        double w = other->PreFSIKinematics_1p->GetBinContent(i + 1) /
-                   (PreFSIKinematics_1p->GetBinContent(i + 1));
-        if (std::isnormal(w)) {
-          for (int j = 0; j < TotalNeutronKE_1p_only->GetXaxis()->GetNbins();
-               ++j) {
-            double bc = TotalNeutronKE_1p_only->GetBinContent(j + 1, i + 1);
-            TotalNeutronKE_1p_only->SetBinContent(j + 1, i + 1, bc * w);
-            double be = TotalNeutronKE_1p_only->GetBinError(j + 1, i + 1);
-            TotalNeutronKE_1p_only->SetBinError(j + 1, i + 1, be * w);
-          }
-        } else {
-          std::cout << "PreFSIKinematics_1p bin " << i << ": w = " << w
-                    << " = ("
-                    << other->PreFSIKinematics_1p->GetBinContent(i + 1) << "/"
-                    << PreFSIKinematics_1p->GetBinContent(i + 1) << ")"
-                    << std::endl;
-        }
+    std::vector<Derived> missing;
+    for (auto const &o : DerivedHists()) {
+      auto &p = projections[o.slice.name];
+      if ((o.source != d->source) || p) {
+        continue;
+      }
+      p = cache.Get(CacheKey(o));
+      if (!p) {
+        missing.push_back(o);
       }
     }
 
-    TotalPi0E_1piplus_1p =
-        std::unique_ptr<TH3D>(fin.Get<TH3D>("TotalPi0E_1piplus_1p"));
-    TotalPi0E_1piplus_1p->SetDirectory(nullptr);
-
-    TotalNeutralE_1piplus_1p =
-        std::unique_ptr<TH3D>(fin.Get<TH3D>("TotalNeutralE_1piplus_1p"));
-    TotalNeutralE_1piplus_1p->SetDirectory(nullptr);
-
-    if (other && reshape) {
-      // reweight each row by the relevant preFSI kinematics shape.
-
-      for (int i = 0; i < PreFSIKinematics_1piplus_1p->GetXaxis()->GetNbins();
-           ++i) {
-        for (int j = 0; j < PreFSIKinematics_1piplus_1p->GetYaxis()->GetNbins();
-             ++j) {
-          double w =
-              other->PreFSIKinematics_1piplus_1p->GetBinContent(i + 1, j + 1) /
-              (PreFSIKinematics_1piplus_1p->GetBinContent(i + 1, j + 1));
-          if (std::isnormal(w)) {
-            for (int k = 0; k < TotalPi0E_1piplus_1p->GetXaxis()->GetNbins();
-                 ++k) {
-              double bc =
-                  TotalPi0E_1piplus_1p->GetBinContent(k + 1, j + 1, i + 1);
-              TotalPi0E_1piplus_1p->SetBinContent(k + 1, j + 1, i + 1, bc * w);
-              double be =
-                  TotalPi0E_1piplus_1p->GetBinError(k + 1, j + 1, i + 1);
-              TotalPi0E_1piplus_1p->SetBinError(k + 1, j + 1, i + 1, be * w);
-            }
-          } else {
-            std::cout << "PreFSIKinematics_1piplus_1p bin (" << i << "," << j
-                      << "): w = " << w << " = ("
-                      << other->PreFSIKinematics_1piplus_1p->GetBinContent(
-                             i + 1, j + 1)
-                      << "/"
-                      << PreFSIKinematics_1piplus_1p->GetBinContent(i + 1,
-                                                                    j + 1)
-                      << ")" << std::endl;
-          }
-        }
+    if (missing.size()) {
+      TH1 *h = Source(d->source);
+      double norm =
+          reference ? reference->RefNorm(d->source) : h->Integral();
+
+      std::vector<XSlice> slices;
+      for (auto const &o : missing) {
+        slices.push_back(o.slice);
+      }
+      auto projs = ProjectSlicesX(*h, slices);
+      for (size_t i = 0; i < missing.size(); ++i) {
+        projs[i]->Scale(1.0 / (double(slices[i].rebin) * norm));
+        cache.Put(CacheKey(missing[i]), *projs[i]);
+        projections[slices[i].name] = std::move(projs[i]);
       }
     }
-
-    Transparency_1p_only =
-        std::unique_ptr<TH1D>(fin.Get<TH1D>("k1p_only_proton_transp"));
-    Transparency_1p_only->SetDirectory(nullptr);
-    Transparency_1piplus_1p =
-        std::unique_ptr<TH1D>(fin.Get<TH1D>("k1piplus_1p_piplus_transp"));
-    Transparency_1piplus_1p->SetDirectory(nullptr);
-
-    double rebin = 4;
-
-    TotalNeutronKE_1p_only_belowcut =
-        std::unique_ptr<TH1D>(CutOffZeroBin(TotalNeutronKE_1p_only->ProjectionX(
-            "TotalNeutronKE_1p_only_belowcut", 2, 11)));
-    TotalNeutronKE_1p_only_belowcut->Scale(
-        1.0 / (other ? other->TotalNeutronKE_1p_only->Integral()
-                     : TotalNeutronKE_1p_only->Integral()));
-    TotalNeutronKE_1p_only_belowcut->SetDirectory(nullptr);
-
-    TotalNeutronKE_1p_only_abovecut = std::unique_ptr<TH1D>(
-        CutOffZeroBin(TotalNeutronKE_1p_only->ProjectionX(
-                          "TotalNeutronKE_1p_only_abovecut", 12, 51),
-                      rebin));
-    TotalNeutronKE_1p_only_abovecut->Scale(
-        1.0 /
-        (double(rebin) * (other ? other->TotalNeutronKE_1p_only->Integral()
-                                : TotalNeutronKE_1p_only->Integral())));
-    TotalNeutronKE_1p_only_abovecut->SetDirectory(nullptr);
-
-    TotalPi0E_1piplus_1p_belowcut =
-        std::unique_ptr<TH1D>(CutOffZeroBin(TotalPi0E_1piplus_1p->ProjectionX(
-            "TotalPi0E_1piplus_1p_belowcut", 2, 51, 2, 16)));
-    TotalPi0E_1piplus_1p_belowcut->Scale(
-        1.0 / (other ? other->TotalPi0E_1piplus_1p->Integral()
-                     : TotalPi0E_1piplus_1p->Integral()));
-    TotalPi0E_1piplus_1p_belowcut->SetDirectory(nullptr);
-
-    TotalPi0E_1piplus_1p_abovecut = std::unique_ptr<TH1D>(
-        CutOffZeroBin(TotalPi0E_1piplus_1p->ProjectionX(
-                          "TotalPi0E_1piplus_1p_abovecut", 2, 51, 17, 31),
-                      rebin));
-    TotalPi0E_1piplus_1p_abovecut->Scale(
-        1.0 / (double(rebin) * (other ? other->TotalPi0E_1piplus_1p->Integral()
-                                      : TotalPi0E_1piplus_1p->Integral())));
-    TotalPi0E_1piplus_1p_abovecut->SetDirectory(nullptr);
-
-    TotalNeutralE_1piplus_1p_belowcut = std::unique_ptr<TH1D>(
-        CutOffZeroBin(TotalNeutralE_1piplus_1p->ProjectionX(
-            "TotalNeutralE_1piplus_1p_belowcut", 2, 51, 2, 16)));
-    TotalNeutralE_1piplus_1p_belowcut->Scale(
-        1.0 / (other ? other->TotalNeutralE_1piplus_1p->Integral()
-                     : TotalNeutralE_1piplus_1p->Integral()));
-    TotalNeutralE_1piplus_1p_belowcut->SetDirectory(nullptr);
-
-    TotalNeutralE_1piplus_1p_abovecut = std::unique_ptr<TH1D>(
-        CutOffZeroBin(TotalNeutralE_1piplus_1p->ProjectionX(
-                          "TotalNeutralE_1piplus_1p_abovecut", 2, 51, 17, 31),
-                      rebin));
-    TotalNeutralE_1piplus_1p_abovecut->Scale(
-        1.0 /
-        (double(rebin) * (other ? other->TotalNeutralE_1piplus_1p->Integral()
-                                : TotalNeutralE_1piplus_1p->Integral())));
-    TotalNeutralE_1piplus_1p_abovecut->SetDirectory(nullptr);
+    return projections[name].get();
   }
-};
 
-int cols[] = {TColor::GetColor("#DDAA33"), TColor::GetColor("#BB5566"),
-              TColor::GetColor("#004488"), TColor::GetColor("#000000")};
+public:
+  // the sample that this one is reshaped and normalised to, nullptr for the
+  // reference itself
+  THBlob *reference = nullptr;
 
-int main(int argc, char const *argv[]) {
-  if (argc < 2) {
-    std::cout << "[RUNLIKE]: " << argv[0] << " <infile.hepmc3>" << std::endl;
-    return 1;
+  THBlob(std::string const &fin_name_)
+      : fin_name(fin_name_), cache(fin_name_) {}
+
+  TH2D *PrimaryToFinalStateSmearing() {
+    bool loaded = hists.count("PrimaryToFinalStateSmearing");
+    TH2D *h = Load<TH2D>("PrimaryToFinalStateSmearing");
+    if (!loaded) {
+      RowNormTH2(h);
+    }
+    return h;
   }
 
-  std::vector<std::pair<std::string, THBlob>> infs;
+  TH1D *Transparency_1p_only() {
+    return Load<TH1D>("k1p_only_proton_transp");
+  }
+  // reads and derives everything that the pages draw
+  void Prefetch() {
+    PrimaryToFinalStateSmearing();
+    Transparency_1p_only();
+    for (auto const &d : DerivedHists()) {
+      Projection(d.slice.name);
+    }
+  }
 
-  for (int i = 1; i < argc; ++i) {
-    std::string arg = argv[i];
+  TH1D *Transparency_1piplus_1p() {
+    return Load<TH1D>("k1piplus_1p_piplus_transp");
+  }
 
-    auto colpos = arg.find_first_of(':');
-    std::string name = arg.substr(0, colpos);
-    std::string fname = arg.substr(colpos + 1);
+  TH1D *TotalNeutronKE_1p_only_belowcut() {
+    return Projection("TotalNeutronKE_1p_only_belowcut");
+  }
+  TH1D *TotalNeutronKE_1p_only_abovecut() {
+    return Projection("TotalNeutronKE_1p_only_abovecut");
+  }
 
-    infs.emplace_back(
-        name, THBlob(fname, infs.size() ? &infs.front().second : nullptr));
+  TH1D *TotalPi0E_1piplus_1p_belowcut() {
+    return Projection("TotalPi0E_1piplus_1p_belowcut");
+  }
+  TH1D *TotalPi0E_1piplus_1p_abovecut() {
+    return Projection("TotalPi0E_1piplus_1p_abovecut");
   }
 
-  double fontsize = 0.075;
+  TH1D *TotalNeutralE_1piplus_1p_belowcut() {
+    return Projection("TotalNeutralE_1piplus_1p_belowcut");
+  }
+  TH1D *TotalNeutralE_1piplus_1p_abovecut() {
+    return Projection("TotalNeutralE_1piplus_1p_abovecut");
+  }
+};
 
+int cols[] = {TColor::GetColor("#DDAA33"), TColor::GetColor("#BB5566"),
+              TColor::GetColor("#004488"), TColor::GetColor("#000000")};
+
+double fontsize = 0.075;
+
+using Samples = std::vector<std::pair<std::string, THBlob>>;
+
+TLatex PageLatex() {
   TLatex ltx;
   ltx.SetTextSize(fontsize);
   ltx.SetTextFont(132);
+  return ltx;
+}
 
-  gStyle->SetOptStat(false);
-  { // 1p->neutron
-    TCanvas c1("c1", "", 1400, 800);
-
-    TPad pleft("pleft", "", 0, 0, 0.5, 1);
-    pleft.AppendPad();
-    pleft.SetLeftMargin(0.28);
-    pleft.SetRightMargin(0.05);
-    pleft.SetTopMargin(0.1);
-    pleft.SetBottomMargin(0.25);
-    TPad pright("pright", "", 0.5, 0, 1, 1);
-    pright.AppendPad();
-    pright.SetLeftMargin(0.02);
-    pright.SetRightMargin(0.26);
-    pright.SetTopMargin(0.1);
-    pright.SetBottomMargin(0.25);
-
-    pleft.cd();
-    int first = 0;
-
-    TLegend *legendl = new TLegend(0.62, 0.575, 0.7975, 0.875);
-    legendl->SetTextFont(132);
-    legendl->SetTextSize(fontsize);
-    legendl->SetBorderSize(0);
-    legendl->SetFillStyle(0);
-    legendl->SetNColumns(1);
-
-    double maxy = 5E-2;
+void AddToAllPlots(TCanvas &c, bool first, bool last) {
+  if (first) {
+    c.Print("allplots.pdf[");
+  }
+  c.Print("allplots.pdf");
+  if (last) {
+    c.Print("allplots.pdf]");
+  }
+}
+
+// Where a finished page goes. Every page is printed to <name>.pdf. When pages
+// are rendered in-process each is also appended to allplots.pdf straight away,
+// a worker process instead saves its canvas to canvas_file so that the parent
+// can assemble allplots.pdf in page order.
+struct PageSink {
+  std::string name;
+  std::string canvas_file;
+  bool first, last;
+
+  void operator()(TCanvas &c1) const {
+    c1.Print((name + ".pdf").c_str());
+    if (canvas_file.length()) {
+      TFile fout(canvas_file.c_str(), "RECREATE");
+      fout.WriteObject(&c1, "c1");
+      return;
+    }
+    AddToAllPlots(c1, first, last);
+  }
+};
 
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
-      if (hb.TotalNeutronKE_1p_only_belowcut->Integral() < 1E-8) {
-        continue;
-      }
+// the summed neutron KE of 1p events
+void Page_TotalNeutronKE_1p(Samples &infs, PageSink const &sink) {
+  TLatex ltx = PageLatex();
+  TCanvas c1("c1", "", 1400, 800);
+
+  TPad pleft("pleft", "", 0, 0, 0.5, 1);
+  pleft.AppendPad();
+  pleft.SetLeftMargin(0.28);
+  pleft.SetRightMargin(0.05);
+  pleft.SetTopMargin(0.1);
+  pleft.SetBottomMargin(0.25);
+  TPad pright("pright", "", 0.5, 0, 1, 1);
+  pright.AppendPad();
+  pright.SetLeftMargin(0.02);
+  pright.SetRightMargin(0.26);
+  pright.SetTopMargin(0.1);
+  pright.SetBottomMargin(0.25);
+
+  pleft.cd();
+  int first = 0;
+
+  TLegend *legendl = new TLegend(0.62, 0.575, 0.7975, 0.875);
+  legendl->SetTextFont(132);
+  legendl->SetTextSize(fontsize);
+  legendl->SetBorderSize(0);
+  legendl->SetFillStyle(0);
+  legendl->SetNColumns(1);
+
+  double maxy = 5E-2;
+
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalNeutronKE_1p_only_belowcut()->Integral() < 1E-8) {
+      continue;
+    }
 
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetTitleFont(132);
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetLabelFont(132);
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetTitle("P.D.F.");
-      hb.TotalNeutronKE_1p_only_belowcut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetRangeUser(0, 0.18);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetLabelFont(132);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetNdivisions(505);
-      hb.TotalNeutronKE_1p_only_belowcut->GetXaxis()->SetTitle("");
-
-      hb.TotalNeutronKE_1p_only_belowcut->SetLineColor(cols[g_it]);
-      hb.TotalNeutronKE_1p_only_belowcut->SetLineWidth(3);
-      hb.TotalNeutronKE_1p_only_belowcut->Draw((!first++) ? "EHIST"
-                                                          : "EHIST SAME");
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetTitle("P.D.F.");
+    hb.TotalNeutronKE_1p_only_belowcut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetRangeUser(0, 0.18);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalNeutronKE_1p_only_belowcut()->GetXaxis()->SetTitle("");
+
+    hb.TotalNeutronKE_1p_only_belowcut()->SetLineColor(cols[g_it]);
+    hb.TotalNeutronKE_1p_only_belowcut()->SetLineWidth(3);
+    hb.TotalNeutronKE_1p_only_belowcut()->Draw((!first++) ? "EHIST"
+                                                        : "EHIST SAME");
+
+    legendl->AddEntry(hb.TotalNeutronKE_1p_only_belowcut(),
+                      infs[g_it].first.c_str(), "l");
+  }
+
+  pright.cd();
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalNeutronKE_1p_only_abovecut()->Integral() < 1E-8) {
+      continue;
+    }
+    hb.TotalNeutronKE_1p_only_abovecut()->Scale(3);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetLabelOffset(1);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetRangeUser(0, 1);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalNeutronKE_1p_only_abovecut()->GetXaxis()->SetTitle("");
+
+    hb.TotalNeutronKE_1p_only_abovecut()->SetLineColor(cols[g_it]);
+    hb.TotalNeutronKE_1p_only_abovecut()->SetLineWidth(3);
+    hb.TotalNeutronKE_1p_only_abovecut()->Draw((!first++) ? "EHIST"
+                                                        : "EHIST SAME");
+  }
+  c1.cd();
+  ltx.DrawLatexNDC(0.75, 0.5, "#times 3");
+  ltx.SetTextAlign(32);
+  ltx.DrawLatexNDC(0.39, 0.08, "#sum");
+  ltx.SetTextAlign(12);
+  ltx.DrawLatexNDC(0.41, 0.08, "#it{T}_{neutron} (GeV)");
+
+  ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{p}^{prim.} < 0.2 GeV");
+  ltx.DrawLatexNDC(0.55, 0.95, "0.2 < #it{T}_{p}^{prim.} < 1 GeV");
+
+  legendl->Draw();
+  sink(c1);
+}
+
+// the summed pi0 energy of 1pi+ 1p events
+void Page_TotalPi0E_1piplus_1p(Samples &infs, PageSink const &sink) {
+  TLatex ltx = PageLatex();
+  ltx.SetTextAlign(12);
+  TCanvas c1("c1", "", 1400, 800);
+
+  TPad pleft("pleft", "", 0, 0, 0.5, 1);
+  pleft.AppendPad();
+  pleft.SetLeftMargin(0.28);
+  pleft.SetRightMargin(0.05);
+  pleft.SetTopMargin(0.1);
+  pleft.SetBottomMargin(0.25);
+  TPad pright("pright", "", 0.5, 0, 1, 1);
+  pright.AppendPad();
+  pright.SetLeftMargin(0.02);
+  pright.SetRightMargin(0.26);
+  pright.SetTopMargin(0.1);
+  pright.SetBottomMargin(0.25);
+
+  pleft.cd();
+  int first = 0;
+  TLegend *legendl = new TLegend(0.7, 0.6, 0.8775, 0.9);
+  legendl->SetTextFont(132);
+  legendl->SetTextSize(fontsize);
+  legendl->SetBorderSize(0);
+  legendl->SetFillStyle(0);
+  legendl->SetNColumns(1);
+
+  double maxy = 1.05E-2;
+
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalPi0E_1piplus_1p_belowcut()->Integral() < 1E-8) {
+      continue;
+    }
 
-      legendl->AddEntry(hb.TotalNeutronKE_1p_only_belowcut.get(),
-                        infs[g_it].first.c_str(), "l");
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetTitle("P.D.F.");
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetRangeUser(0.13, 0.5);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalPi0E_1piplus_1p_belowcut()->GetXaxis()->SetTitle("");
+
+    hb.TotalPi0E_1piplus_1p_belowcut()->SetLineColor(cols[g_it]);
+    hb.TotalPi0E_1piplus_1p_belowcut()->SetLineWidth(3);
+    hb.TotalPi0E_1piplus_1p_belowcut()->Draw((!first++) ? "EHIST"
+                                                      : "EHIST SAME");
+    legendl->AddEntry(hb.TotalPi0E_1piplus_1p_belowcut(),
+                      infs[g_it].first.c_str(), "l");
+  }
+
+  pright.cd();
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalPi0E_1piplus_1p_abovecut()->Integral() < 1E-8) {
+      continue;
+    }
+    hb.TotalPi0E_1piplus_1p_abovecut()->Scale(3);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetLabelOffset(1);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetRangeUser(0.13, 1);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalPi0E_1piplus_1p_abovecut()->GetXaxis()->SetTitle("");
+
+    hb.TotalPi0E_1piplus_1p_abovecut()->SetLineColor(cols[g_it]);
+    hb.TotalPi0E_1piplus_1p_abovecut()->SetLineWidth(3);
+    hb.TotalPi0E_1piplus_1p_abovecut()->Draw((!first++) ? "EHIST"
+                                                      : "EHIST SAME");
+  }
+  c1.cd();
+  ltx.DrawLatexNDC(0.75, 0.5, "#times 3");
+  ltx.SetTextAlign(32);
+  ltx.DrawLatexNDC(0.39, 0.08, "#sum");
+  ltx.SetTextAlign(12);
+  ltx.DrawLatexNDC(0.41, 0.08, "#it{E}_{#pi^{0}} (GeV)");
+
+  ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{#pi^{+}}^{prim.} < 0.3 GeV");
+  ltx.DrawLatexNDC(0.55, 0.95, "0.3 < #it{T}_{#pi^{+}}^{prim.} < 1 GeV");
+
+  legendl->Draw();
+  sink(c1);
+}
+
+// the summed neutral energy of 1pi+ 1p events
+void Page_TotalNeutralE_1piplus_1p(Samples &infs, PageSink const &sink) {
+  TLatex ltx = PageLatex();
+  ltx.SetTextAlign(12);
+  TCanvas c1("c1", "", 1400, 800);
+
+  TPad pleft("pleft", "", 0, 0, 0.5, 1);
+  pleft.AppendPad();
+  pleft.SetLeftMargin(0.28);
+  pleft.SetRightMargin(0.05);
+  pleft.SetTopMargin(0.1);
+  pleft.SetBottomMargin(0.25);
+  TPad pright("pright", "", 0.5, 0, 1, 1);
+  pright.AppendPad();
+  pright.SetLeftMargin(0.02);
+  pright.SetRightMargin(0.26);
+  pright.SetTopMargin(0.1);
+  pright.SetBottomMargin(0.25);
+
+  pleft.cd();
+  int first = 0;
+  TLegend *legendl = new TLegend(0.7, 0.6, 0.8775, 0.9);
+  legendl->SetTextFont(132);
+  legendl->SetTextSize(fontsize);
+  legendl->SetBorderSize(0);
+  legendl->SetFillStyle(0);
+  legendl->SetNColumns(1);
+
+  double maxy = 12E-2;
+
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalNeutralE_1piplus_1p_belowcut()->Integral() < 1E-8) {
+      continue;
     }
 
-    pright.cd();
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
-      if (hb.TotalNeutronKE_1p_only_abovecut->Integral() < 1E-8) {
-        continue;
-      }
-      hb.TotalNeutronKE_1p_only_abovecut->Scale(3);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetLabelOffset(1);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetTitleFont(132);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetLabelFont(132);
-      hb.TotalNeutronKE_1p_only_abovecut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetRangeUser(0, 1);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetLabelFont(132);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetNdivisions(505);
-      hb.TotalNeutronKE_1p_only_abovecut->GetXaxis()->SetTitle("");
-
-      hb.TotalNeutronKE_1p_only_abovecut->SetLineColor(cols[g_it]);
-      hb.TotalNeutronKE_1p_only_abovecut->SetLineWidth(3);
-      hb.TotalNeutronKE_1p_only_abovecut->Draw((!first++) ? "EHIST"
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetTitle("P.D.F.");
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetRangeUser(0, 0.6);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->GetXaxis()->SetTitle("");
+
+    hb.TotalNeutralE_1piplus_1p_belowcut()->SetLineColor(cols[g_it]);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->SetLineWidth(3);
+    hb.TotalNeutralE_1piplus_1p_belowcut()->Draw((!first++) ? "EHIST"
                                                           : "EHIST SAME");
+    legendl->AddEntry(hb.TotalNeutralE_1piplus_1p_belowcut(),
+                      infs[g_it].first.c_str(), "l");
+  }
+
+  pright.cd();
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+    if (hb.TotalNeutralE_1piplus_1p_abovecut()->Integral() < 1E-8) {
+      continue;
     }
-    c1.cd();
-    ltx.DrawLatexNDC(0.75, 0.5, "#times 3");
-    ltx.SetTextAlign(32);
-    ltx.DrawLatexNDC(0.39, 0.08, "#sum");
-    ltx.SetTextAlign(12);
-    ltx.DrawLatexNDC(0.41, 0.08, "#it{T}_{neutron} (GeV)");
-
-    ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{p}^{prim.} < 0.2 GeV");
-    ltx.DrawLatexNDC(0.55, 0.95, "0.2 < #it{T}_{p}^{prim.} < 1 GeV");
-
-    legendl->Draw();
-    c1.Print("TotalNeutronKE_1p.pdf");
-    c1.Print("allplots.pdf[");
-    c1.Print("allplots.pdf");
-  }
-
-  { // 1p->neutron
-    TCanvas c1("c1", "", 1400, 800);
-
-    TPad pleft("pleft", "", 0, 0, 0.5, 1);
-    pleft.AppendPad();
-    pleft.SetLeftMargin(0.28);
-    pleft.SetRightMargin(0.05);
-    pleft.SetTopMargin(0.1);
-    pleft.SetBottomMargin(0.25);
-    TPad pright("pright", "", 0.5, 0, 1, 1);
-    pright.AppendPad();
-    pright.SetLeftMargin(0.02);
-    pright.SetRightMargin(0.26);
-    pright.SetTopMargin(0.1);
-    pright.SetBottomMargin(0.25);
-
-    pleft.cd();
-    int first = 0;
-    TLegend *legendl = new TLegend(0.7, 0.6, 0.8775, 0.9);
-    legendl->SetTextFont(132);
-    legendl->SetTextSize(fontsize);
-    legendl->SetBorderSize(0);
-    legendl->SetFillStyle(0);
-    legendl->SetNColumns(1);
-
-    double maxy = 1.05E-2;
+    hb.TotalNeutralE_1piplus_1p_abovecut()->Scale(7.5);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetLabelOffset(1);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetTitleFont(132);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetLabelFont(132);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetYaxis()->SetNdivisions(505);
+
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetRangeUser(0, 1);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetLabelSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetTitleSize(fontsize);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetLabelFont(132);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetTitleOffset(1);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetNdivisions(505);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->GetXaxis()->SetTitle("");
+
+    hb.TotalNeutralE_1piplus_1p_abovecut()->SetLineColor(cols[g_it]);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->SetLineWidth(3);
+    hb.TotalNeutralE_1piplus_1p_abovecut()->Draw((!first++) ? "EHIST"
+                                                          : "EHIST SAME");
+  }
+  c1.cd();
+  ltx.DrawLatexNDC(0.75, 0.5, "#times 7.5");
+  ltx.SetTextAlign(32);
+  ltx.DrawLatexNDC(0.39, 0.08, "#sum");
+  ltx.SetTextAlign(12);
+  ltx.DrawLatexNDC(0.41, 0.08, "#it{T}_{neutron} + #it{E}_{#pi^{0}} (GeV)");
+
+  ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{#pi^{+}}^{prim.} < 0.3 GeV");
+  ltx.DrawLatexNDC(0.55, 0.95, "0.3 < #it{T}_{#pi^{+}}^{prim.} < 1 GeV");
+
+  legendl->Draw();
+  sink(c1);
+}
+
+// the proton transparency
+void Page_Transparency_1p(Samples &infs, PageSink const &sink) {
+  TCanvas c1("c1", "", 1200, 1200);
+
+  c1.SetLeftMargin(0.25);
+  c1.SetRightMargin(0.05);
+  c1.SetTopMargin(0.05);
+  c1.SetBottomMargin(0.25);
+
+  int first = 0;
+  TLegend *legendl = new TLegend(0.5, 0.65, 0.94, 0.93);
+  legendl->SetTextFont(132);
+  legendl->SetTextSize(fontsize);
+  legendl->SetBorderSize(0);
+  legendl->SetFillStyle(0);
+  legendl->SetNColumns(1);
+
+  double maxy = 1;
+
+  first = 0;
+  for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
+    auto &hb = infs[g_it].second;
+
+    hb.Transparency_1p_only()->GetYaxis()->SetRangeUser(0, maxy);
+    hb.Transparency_1p_only()->GetYaxis()->SetLabelSize(fontsize);
+    hb.Transparency_1p_only()->GetYaxis()->SetTitleSize(fontsize);
+    hb.Transparency_1p_only()->GetYaxis()->SetTitleFont(132);
+    hb.Transparency_1p_only()->GetYaxis()->SetLabelFont(132);
+    hb.Transparency_1p_only()->GetYaxis()->SetTitle(
+        "Proton Transparency, #theta_{scatter} < 5^{#circ}");
+    hb.Transparency_1p_only()->GetYaxis()->SetNdivisions(505);
+
+    hb.Transparency_1p_only()->GetXaxis()->SetRangeUser(0.02, 1);
+    hb.Transparency_1p_only()->GetXaxis()->SetLabelSize(fontsize);
+    hb.Transparency_1p_only()->GetXaxis()->SetTitleSize(fontsize);
+    hb.Transparency_1p_only()->GetXaxis()->SetLabelFont(132);
+    hb.Transparency_1p_only()->GetXaxis()->SetTitleFont(132);
+    hb.Transparency_1p_only()->GetXaxis()->SetTitleOffset(1);
+    hb.Transparency_1p_only()->GetXaxis()->SetNdivisions(505);
+    hb.Transparency_1p_only()->GetXaxis()->SetTitle("T_{Proton} GeV");
+
+    hb.Transparency_1p_only()->SetLineColor(cols[g_it]);
+    hb.Transparency_1p_only()->SetLineWidth(4);
+    hb.Transparency_1p_only()->Draw((!first++) ? "EHIST" : "EHIST SAME");
+    legendl->AddEntry(hb.Transparency_1p_only(), infs[g_it].first.c_str(),
+                      "l");
+  }
+
+  legendl->Draw();
+  sink(c1);
+}
+
+// the final state topologies of each pre-FSI topology
+void Page_PrimaryToFinalStateSmearing(Samples &infs, PageSink const &sink) {
+  TLatex ltx = PageLatex();
+  TCanvas c1("c1", "", 1200, 1200);
+
+  int first = 0;
+  TLegend *legendl = new TLegend(0.05, 0.9, 0.95, 1);
+  legendl->SetTextFont(132);
+  legendl->SetTextSize(fontsize * 0.75);
+  legendl->SetBorderSize(0);
+  legendl->SetFillStyle(0);
+  legendl->SetNColumns(4);
+
+  std::vector<TPad *> pads;
+
+  double ywidth = 0.25;
+
+  for (int i = 0; i < 3; ++i) {
+    pads.emplace_back(new TPad(("p_" + std::to_string(i)).c_str(), "", 0.,
+                               0.175 + ywidth * i, 1.,
+                               0.175 + ywidth * (i + 1)));
+    pads.back()->AppendPad();
+    pads.back()->SetLeftMargin(0.1);
+    pads.back()->SetRightMargin(0.1);
+    pads.back()->SetTopMargin(0.05);
+    pads.back()->SetBottomMargin(0.05);
+  }
+
+  double maxy = 0.65;
+
+  int indx[] = {1, 3, 4};
+
+  for (int i = 0; i < 3; ++i) {
+    pads[i]->cd();
 
     first = 0;
     for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
       auto &hb = infs[g_it].second;
-      if (hb.TotalPi0E_1piplus_1p_belowcut->Integral() < 1E-8) {
-        continue;
+
+      auto proj = hb.PrimaryToFinalStateSmearing()->ProjectionX(
+          ("PrimaryToFinalStateSmearing_" + std::to_string(g_it) + "_" +
+           std::to_string(i))
+              .c_str(),
+          indx[i], indx[i]);
+
+      proj->GetYaxis()->SetRangeUser(0, maxy);
+      proj->GetYaxis()->SetLabelSize(fontsize * 2);
+      proj->GetYaxis()->SetTitleSize(fontsize * 2);
+      proj->GetYaxis()->SetTitleFont(132);
+      proj->GetYaxis()->SetLabelFont(132);
+      proj->GetXaxis()->SetTitleOffset(0.01);
+      proj->GetYaxis()->SetTitle("P.D.F");
+      proj->GetYaxis()->SetNdivisions(505);
+
+      proj->GetXaxis()->SetRangeUser(0, 1);
+      proj->GetXaxis()->SetLabelSize(fontsize);
+      proj->GetXaxis()->SetTitleSize(fontsize);
+      proj->GetXaxis()->SetLabelFont(132);
+      proj->GetXaxis()->SetTitleOffset(1);
+      proj->GetXaxis()->SetLabelOffset(1);
+      proj->GetXaxis()->SetNdivisions(505);
+
+      proj->SetLineColor(cols[g_it]);
+      proj->SetLineWidth(3);
+      proj->Draw((!first++) ? "EHIST" : "EHIST SAME");
+      if (!i) {
+        legendl->AddEntry(proj, infs[g_it].first.c_str(), "l");
       }
 
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetTitleFont(132);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetLabelFont(132);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetTitle("P.D.F.");
-      hb.TotalPi0E_1piplus_1p_belowcut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetRangeUser(0.13, 0.5);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetLabelFont(132);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetNdivisions(505);
-      hb.TotalPi0E_1piplus_1p_belowcut->GetXaxis()->SetTitle("");
-
-      hb.TotalPi0E_1piplus_1p_belowcut->SetLineColor(cols[g_it]);
-      hb.TotalPi0E_1piplus_1p_belowcut->SetLineWidth(3);
-      hb.TotalPi0E_1piplus_1p_belowcut->Draw((!first++) ? "EHIST"
-                                                        : "EHIST SAME");
-      legendl->AddEntry(hb.TotalPi0E_1piplus_1p_belowcut.get(),
-                        infs[g_it].first.c_str(), "l");
+      ltx.SetTextAlign(12);
+      ltx.SetTextSize(0.15);
+      ltx.DrawLatexNDC(
+          0.3, 0.8,
+          (std::string("Pre-FSI Topology: ") +
+           hb.PrimaryToFinalStateSmearing()->GetYaxis()->GetBinLabel(indx[i]))
+              .c_str());
     }
+  }
 
-    pright.cd();
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
-      if (hb.TotalPi0E_1piplus_1p_abovecut->Integral() < 1E-8) {
-        continue;
-      }
-      hb.TotalPi0E_1piplus_1p_abovecut->Scale(3);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetLabelOffset(1);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetTitleFont(132);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetLabelFont(132);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetRangeUser(0.13, 1);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetLabelFont(132);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetNdivisions(505);
-      hb.TotalPi0E_1piplus_1p_abovecut->GetXaxis()->SetTitle("");
-
-      hb.TotalPi0E_1piplus_1p_abovecut->SetLineColor(cols[g_it]);
-      hb.TotalPi0E_1piplus_1p_abovecut->SetLineWidth(3);
-      hb.TotalPi0E_1piplus_1p_abovecut->Draw((!first++) ? "EHIST"
-                                                        : "EHIST SAME");
+  c1.cd();
+
+  for (int i = 0; i < infs.front()
+                          .second.PrimaryToFinalStateSmearing()->GetXaxis()
+                          ->GetNbins();
+       ++i) {
+    double l = 0.1, r = 0.1;
+    double w = 1 - (l + r);
+    double bw = w / double(infs.front()
+                               .second.PrimaryToFinalStateSmearing()->GetXaxis()
+                               ->GetNbins());
+    ltx.SetTextSize(0.03);
+    ltx.SetTextAngle(-45);
+    ltx.DrawLatexNDC(l + bw * i + 0.5 * bw, 0.175,
+                     infs.front()
+                         .second.PrimaryToFinalStateSmearing()->GetXaxis()
+                         ->GetBinLabel(i + 1));
+  }
+
+  ltx.SetTextSize(fontsize);
+  ltx.SetTextAngle(0);
+  ltx.DrawLatexNDC(0.25, 0.05, "Final State Topology");
+
+  legendl->Draw();
+  sink(c1);
+}
+
+using Page = std::pair<std::string, void (*)(Samples &, PageSink const &)>;
+
+// Renders the pages in up to njobs forked worker processes, which inherit the
+// samples that are already loaded and reshaped. ROOT's graphics are not
+// thread safe, so pages are rendered in separate processes rather than on
+// threads. Once every worker has finished, allplots.pdf is assembled in page
+// order from the saved canvases.
+bool RenderPages(Samples &infs, std::vector<Page> const &pages,
+                 size_t njobs) {
+  if (njobs < 2) {
+    for (size_t i = 0; i < pages.size(); ++i) {
+      pages[i].second(infs, PageSink{pages[i].first, "", !i,
+                                     (i + 1) == pages.size()});
     }
-    c1.cd();
-    ltx.DrawLatexNDC(0.75, 0.5, "#times 3");
-    ltx.SetTextAlign(32);
-    ltx.DrawLatexNDC(0.39, 0.08, "#sum");
-    ltx.SetTextAlign(12);
-    ltx.DrawLatexNDC(0.41, 0.08, "#it{E}_{#pi^{0}} (GeV)");
-
-    ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{#pi^{+}}^{prim.} < 0.3 GeV");
-    ltx.DrawLatexNDC(0.55, 0.95, "0.3 < #it{T}_{#pi^{+}}^{prim.} < 1 GeV");
-
-    legendl->Draw();
-    c1.Print("TotalPi0E_1piplus_1p.pdf");
-    c1.Print("allplots.pdf");
-  }
-
-  { // 1p->neutron
-    TCanvas c1("c1", "", 1400, 800);
-
-    TPad pleft("pleft", "", 0, 0, 0.5, 1);
-    pleft.AppendPad();
-    pleft.SetLeftMargin(0.28);
-    pleft.SetRightMargin(0.05);
-    pleft.SetTopMargin(0.1);
-    pleft.SetBottomMargin(0.25);
-    TPad pright("pright", "", 0.5, 0, 1, 1);
-    pright.AppendPad();
-    pright.SetLeftMargin(0.02);
-    pright.SetRightMargin(0.26);
-    pright.SetTopMargin(0.1);
-    pright.SetBottomMargin(0.25);
-
-    pleft.cd();
-    int first = 0;
-    TLegend *legendl = new TLegend(0.7, 0.6, 0.8775, 0.9);
-    legendl->SetTextFont(132);
-    legendl->SetTextSize(fontsize);
-    legendl->SetBorderSize(0);
-    legendl->SetFillStyle(0);
-    legendl->SetNColumns(1);
-
-    double maxy = 12E-2;
+    return true;
+  }
 
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
-      if (hb.TotalNeutralE_1piplus_1p_belowcut->Integral() < 1E-8) {
-        continue;
-      }
+  bool ok = true;
+  std::vector<std::string> canvas_files;
+  std::map<pid_t, size_t> running;
+
+  auto wait_one = [&]() {
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid <= 0) {
+      running.clear();
+      ok = false;
+      return;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+      std::cout << "Failed to render " << pages[running[pid]].first
+                << std::endl;
+      ok = false;
+    }
+    running.erase(pid);
+  };
 
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetTitleFont(132);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetLabelFont(132);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetTitle("P.D.F.");
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetRangeUser(0, 0.6);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetLabelFont(132);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetNdivisions(505);
-      hb.TotalNeutralE_1piplus_1p_belowcut->GetXaxis()->SetTitle("");
-
-      hb.TotalNeutralE_1piplus_1p_belowcut->SetLineColor(cols[g_it]);
-      hb.TotalNeutralE_1piplus_1p_belowcut->SetLineWidth(3);
-      hb.TotalNeutralE_1piplus_1p_belowcut->Draw((!first++) ? "EHIST"
-                                                            : "EHIST SAME");
-      legendl->AddEntry(hb.TotalNeutralE_1piplus_1p_belowcut.get(),
-                        infs[g_it].first.c_str(), "l");
-    }
-
-    pright.cd();
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
-      if (hb.TotalNeutralE_1piplus_1p_abovecut->Integral() < 1E-8) {
-        continue;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    while (running.size() >= njobs) {
+      wait_one();
+    }
+
+    canvas_files.push_back(".prettyplots_" + std::to_string(getpid()) + "_" +
+                           std::to_string(i) + ".root");
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cout << "Failed to fork a worker for " << pages[i].first
+                << std::endl;
+      ok = false;
+      break;
+    }
+    if (!pid) {
+      int rc = 0;
+      try {
+        pages[i].second(
+            infs, PageSink{pages[i].first, canvas_files[i], false, false});
+      } catch (std::exception const &e) {
+        std::cout << e.what() << std::endl;
+        rc = 1;
       }
-      hb.TotalNeutralE_1piplus_1p_abovecut->Scale(7.5);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetRangeUser(0, maxy);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetLabelOffset(1);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetTitleFont(132);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetLabelFont(132);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetYaxis()->SetNdivisions(505);
-
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetRangeUser(0, 1);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetLabelSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetTitleSize(fontsize);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetLabelFont(132);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetTitleOffset(1);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetNdivisions(505);
-      hb.TotalNeutralE_1piplus_1p_abovecut->GetXaxis()->SetTitle("");
-
-      hb.TotalNeutralE_1piplus_1p_abovecut->SetLineColor(cols[g_it]);
-      hb.TotalNeutralE_1piplus_1p_abovecut->SetLineWidth(3);
-      hb.TotalNeutralE_1piplus_1p_abovecut->Draw((!first++) ? "EHIST"
-                                                            : "EHIST SAME");
-    }
-    c1.cd();
-    ltx.DrawLatexNDC(0.75, 0.5, "#times 7.5");
-    ltx.SetTextAlign(32);
-    ltx.DrawLatexNDC(0.39, 0.08, "#sum");
-    ltx.SetTextAlign(12);
-    ltx.DrawLatexNDC(0.41, 0.08, "#it{T}_{neutron} + #it{E}_{#pi^{0}} (GeV)");
-
-    ltx.DrawLatexNDC(0.2, 0.95, "#it{T}_{#pi^{+}}^{prim.} < 0.3 GeV");
-    ltx.DrawLatexNDC(0.55, 0.95, "0.3 < #it{T}_{#pi^{+}}^{prim.} < 1 GeV");
-
-    legendl->Draw();
-    c1.Print("TotalNeutralE_1piplus_1p.pdf");
-    c1.Print("allplots.pdf");
-  }
-
-  { // transparency
-    TCanvas c1("c1", "", 1200, 1200);
-
-    c1.SetLeftMargin(0.25);
-    c1.SetRightMargin(0.05);
-    c1.SetTopMargin(0.05);
-    c1.SetBottomMargin(0.25);
-
-    int first = 0;
-    TLegend *legendl = new TLegend(0.5, 0.65, 0.94, 0.93);
-    legendl->SetTextFont(132);
-    legendl->SetTextSize(fontsize);
-    legendl->SetBorderSize(0);
-    legendl->SetFillStyle(0);
-    legendl->SetNColumns(1);
-
-    double maxy = 1;
+      std::cout << std::flush;
+      _exit(rc);
+    }
+    running[pid] = i;
+  }
+  while (running.size()) {
+    wait_one();
+  }
 
-    first = 0;
-    for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-      auto &hb = infs[g_it].second;
+  for (size_t i = 0; ok && (i < canvas_files.size()); ++i) {
+    TFile fin(canvas_files[i].c_str(), "READ");
+    std::unique_ptr<TCanvas> c(fin.IsZombie() ? nullptr
+                                              : fin.Get<TCanvas>("c1"));
+    if (!c) {
+      std::cout << "Failed to read the canvas of " << pages[i].first
+                << " from " << canvas_files[i] << std::endl;
+      ok = false;
+      break;
+    }
+    c->Draw();
+    AddToAllPlots(*c, !i, (i + 1) == pages.size());
+  }
+  for (auto const &f : canvas_files) {
+    std::remove(f.c_str());
+  }
+  return ok;
+}
 
-      hb.Transparency_1p_only->GetYaxis()->SetRangeUser(0, maxy);
-      hb.Transparency_1p_only->GetYaxis()->SetLabelSize(fontsize);
-      hb.Transparency_1p_only->GetYaxis()->SetTitleSize(fontsize);
-      hb.Transparency_1p_only->GetYaxis()->SetTitleFont(132);
-      hb.Transparency_1p_only->GetYaxis()->SetLabelFont(132);
-      hb.Transparency_1p_only->GetYaxis()->SetTitle(
-          "Proton Transparency, #theta_{scatter} < 5^{#circ}");
-      hb.Transparency_1p_only->GetYaxis()->SetNdivisions(505);
-
-      hb.Transparency_1p_only->GetXaxis()->SetRangeUser(0.02, 1);
-      hb.Transparency_1p_only->GetXaxis()->SetLabelSize(fontsize);
-      hb.Transparency_1p_only->GetXaxis()->SetTitleSize(fontsize);
-      hb.Transparency_1p_only->GetXaxis()->SetLabelFont(132);
-      hb.Transparency_1p_only->GetXaxis()->SetTitleFont(132);
-      hb.Transparency_1p_only->GetXaxis()->SetTitleOffset(1);
-      hb.Transparency_1p_only->GetXaxis()->SetNdivisions(505);
-      hb.Transparency_1p_only->GetXaxis()->SetTitle("T_{Proton} GeV");
-
-      hb.Transparency_1p_only->SetLineColor(cols[g_it]);
-      hb.Transparency_1p_only->SetLineWidth(4);
-      hb.Transparency_1p_only->Draw((!first++) ? "EHIST" : "EHIST SAME");
-      legendl->AddEntry(hb.Transparency_1p_only.get(), infs[g_it].first.c_str(),
-                        "l");
-    }
-
-    legendl->Draw();
-    c1.Print("TotalNeutralE_1piplus_1p.pdf");
-    c1.Print("allplots.pdf");
-  }
-  {
-
-    TCanvas c1("c1", "", 1200, 1200);
-
-    int first = 0;
-    TLegend *legendl = new TLegend(0.05, 0.9, 0.95, 1);
-    legendl->SetTextFont(132);
-    legendl->SetTextSize(fontsize * 0.75);
-    legendl->SetBorderSize(0);
-    legendl->SetFillStyle(0);
-    legendl->SetNColumns(4);
-
-    std::vector<TPad *> pads;
-
-    double ywidth = 0.25;
-
-    for (int i = 0; i < 3; ++i) {
-      pads.emplace_back(new TPad(("p_" + std::to_string(i)).c_str(), "", 0.,
-                                 0.175 + ywidth * i, 1.,
-                                 0.175 + ywidth * (i + 1)));
-      pads.back()->AppendPad();
-      pads.back()->SetLeftMargin(0.1);
-      pads.back()->SetRightMargin(0.1);
-      pads.back()->SetTopMargin(0.05);
-      pads.back()->SetBottomMargin(0.05);
-    }
-
-    double maxy = 0.65;
-
-    int indx[] = {1, 3, 4};
-
-    for (int i = 0; i < 3; ++i) {
-      pads[i]->cd();
-
-      first = 0;
-      for (size_t g_it = 0; g_it < infs.size(); ++g_it) {
-        auto &hb = infs[g_it].second;
-
-        auto proj = hb.PrimaryToFinalStateSmearing->ProjectionX(
-            ("PrimaryToFinalStateSmearing_" + std::to_string(g_it) + "_" +
-             std::to_string(i))
-                .c_str(),
-            indx[i], indx[i]);
-
-        proj->GetYaxis()->SetRangeUser(0, maxy);
-        proj->GetYaxis()->SetLabelSize(fontsize * 2);
-        proj->GetYaxis()->SetTitleSize(fontsize * 2);
-        proj->GetYaxis()->SetTitleFont(132);
-        proj->GetYaxis()->SetLabelFont(132);
-        proj->GetXaxis()->SetTitleOffset(0.01);
-        proj->GetYaxis()->SetTitle("P.D.F");
-        proj->GetYaxis()->SetNdivisions(505);
-
-        proj->GetXaxis()->SetRangeUser(0, 1);
-        proj->GetXaxis()->SetLabelSize(fontsize);
-        proj->GetXaxis()->SetTitleSize(fontsize);
-        proj->GetXaxis()->SetLabelFont(132);
-        proj->GetXaxis()->SetTitleOffset(1);
-        proj->GetXaxis()->SetLabelOffset(1);
-        proj->GetXaxis()->SetNdivisions(505);
-
-        proj->SetLineColor(cols[g_it]);
-        proj->SetLineWidth(3);
-        proj->Draw((!first++) ? "EHIST" : "EHIST SAME");
-        if (!i) {
-          legendl->AddEntry(proj, infs[g_it].first.c_str(), "l");
-        }
+int main(int argc, char const *argv[]) {
+  if (argc < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [-j <njobs>] [--reference <name>] <name:nustecana.root> ..."
+              << std::endl;
+    return 1;
+  }
 
-        ltx.SetTextAlign(12);
-        ltx.SetTextSize(0.15);
-        ltx.DrawLatexNDC(
-            0.3, 0.8,
-            (std::string("Pre-FSI Topology: ") +
-             hb.PrimaryToFinalStateSmearing->GetYaxis()->GetBinLabel(indx[i]))
-                .c_str());
-      }
+  // name:file pairs, the reshaping reference is the first unless chosen with
+  // --reference <name>
+  std::vector<std::pair<std::string, std::string>> inputs;
+  std::string refname;
+  size_t njobs = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "--reference") && ((i + 1) < argc)) {
+      refname = argv[++i];
+      continue;
+    }
+    if ((arg == "-j") && ((i + 1) < argc)) {
+      njobs = std::max(1, std::stoi(argv[++i]));
+      continue;
     }
 
-    c1.cd();
+    auto colpos = arg.find_first_of(':');
+    inputs.emplace_back(arg.substr(0, colpos), arg.substr(colpos + 1));
+  }
 
-    for (int i = 0; i < infs.front()
-                            .second.PrimaryToFinalStateSmearing->GetXaxis()
-                            ->GetNbins();
-         ++i) {
-      double l = 0.1, r = 0.1;
-      double w = 1 - (l + r);
-      double bw = w / double(infs.front()
-                                 .second.PrimaryToFinalStateSmearing->GetXaxis()
-                                 ->GetNbins());
-      ltx.SetTextSize(0.03);
-      ltx.SetTextAngle(-45);
-      ltx.DrawLatexNDC(l + bw * i + 0.5 * bw, 0.175,
-                       infs.front()
-                           .second.PrimaryToFinalStateSmearing->GetXaxis()
-                           ->GetBinLabel(i + 1));
+  size_t ref = 0;
+  if (refname.length()) {
+    while ((ref < inputs.size()) && (inputs[ref].first != refname)) {
+      ref++;
+    }
+    if (ref == inputs.size()) {
+      std::cout << "No input named " << refname << " to use as the reference"
+                << std::endl;
+      return 1;
     }
+  }
 
-    ltx.SetTextSize(fontsize);
-    ltx.SetTextAngle(0);
-    ltx.DrawLatexNDC(0.25, 0.05, "Final State Topology");
+  // nothing is read until a page draws it, so the samples only need to know
+  // which of them is the reference
+  Samples infs;
+  infs.reserve(inputs.size());
+  for (auto const &in : inputs) {
+    infs.emplace_back(in.first, THBlob(in.second));
+  }
+  std::vector<size_t> others;
+  for (size_t i = 0; i < infs.size(); ++i) {
+    if (i != ref) {
+      infs[i].second.reference = &infs[ref].second;
+      others.push_back(i);
+    }
+  }
 
-    legendl->Draw();
-    c1.Print("TotalNeutralE_1piplus_1p.pdf");
-    c1.Print("allplots.pdf");
-    c1.Print("allplots.pdf]");
+  ROOT::EnableThreadSafety();
+  TH1::AddDirectory(false);
+
+  // the reference is loaded first and then every other sample, which reads
+  // the reference's preFSI kinematics, is loaded on up to njobs threads.
+  // Forked page workers inherit the loaded samples.
+  try {
+    infs[ref].second.Prefetch();
+
+    std::atomic<size_t> next{0};
+    size_t nthreads = std::min(njobs, others.size());
+    std::vector<std::exception_ptr> errors(nthreads);
+    std::vector<std::thread> loaders;
+    for (size_t t = 0; t < nthreads; ++t) {
+      loaders.emplace_back([&, t]() {
+        try {
+          for (size_t i = next++; i < others.size(); i = next++) {
+            infs[others[i]].second.Prefetch();
+          }
+        } catch (...) {
+          errors[t] = std::current_exception();
+        }
+      });
+    }
+    for (auto &l : loaders) {
+      l.join();
+    }
+    for (auto const &e : errors) {
+      if (e) {
+        std::rethrow_exception(e);
+      }
+    }
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
   }
-}
\ No newline at end of file
+
+  gStyle->SetOptStat(false);
+
+  std::vector<Page> pages = {
+      {"TotalNeutronKE_1p", Page_TotalNeutronKE_1p},
+      {"TotalPi0E_1piplus_1p", Page_TotalPi0E_1piplus_1p},
+      {"TotalNeutralE_1piplus_1p", Page_TotalNeutralE_1piplus_1p},
+      {"Transparency_1p", Page_Transparency_1p},
+      {"PrimaryToFinalStateSmearing", Page_PrimaryToFinalStateSmearing}};
+
+  return RenderPages(infs, pages, njobs) ? 0 : 1;
+}
@@ -0,0 +1,483 @@
+#pragma once
+
+#include "commonana.hxx"
+#include "fasthist.hxx"
+#include "skim.hxx"
+#include "stagestats.hxx"
+
+#include "HepMC3/GenEvent.h"
+
+#include "NuHepMC/EventUtils.hxx"
+
+#include "TDirectory.h"
+
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <istream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The histograms and per-event analysis of nustecana, shared with the
+// benchmarks so that they time exactly the code that nustecana runs.
+
+// set from the run info before any event is processed
+double ToGeV = 1;
+bool isGENIE = false;
+
+std::pair<FastHist, FastHist> TransparencyFact(Classification c,
+                                               std::string suffix = "") {
+
+  auto tn = TransparencyName(c, suffix);
+  std::string primpart = Topologies[c].primpart;
+
+  std::string title =
+      ";Primary " + primpart +
+      " KE (GeV); Nuclear transparency (#theta_{deflect} < 5^{#circ})";
+
+  return {FastHist(tn.first, title, FastAxis(50, 0, 1)),
+          FastHist(tn.second, title, FastAxis(50, 0, 1))};
+}
+
+// All of the histograms filled by ProcessEvent. Each worker thread fills its
+// own copy with one block of events at a time, which is then summed into the
+// total by OrderedSum. The ROOT histograms are only built when the set is
+// written.
+struct HistSet {
+  FastHist TrueChannelToFSTopo;
+
+  // plots
+  FastHist PreFSIKinematics_1p;
+
+  FastHist TotalNeutronKE_1p_only;
+  FastHist TotalNeutralE_1p_only;
+
+  FastHist PreFSIKinematics_1piplus_1p;
+
+  FastHist TotalPi0E_1piplus_1p;
+  FastHist TotalNeutralE_1piplus_1p;
+
+  // transparency, indexed by primary topology, only the pclasses are booked
+  std::array<std::pair<FastHist, FastHist>, kNumClass> Transparency;
+  std::array<std::pair<FastHist, FastHist>, kNumClass> Transparency_5deg;
+
+  FastHist PrimaryToFinalStateSmearing;
+
+  // the event weight that each universe is filled with and the directory it
+  // is written to. Empty for the default single universe filled with the
+  // first weight and written directly to the output directory.
+  std::vector<size_t> universes;
+  std::vector<std::string> universe_names;
+  // the current event's weight for each universe
+  std::vector<double> uweights;
+
+  // if set, every selected event is also added to a skim, the rows of the
+  // current block are kept here until it is summed
+  SkimWriter *skim = nullptr;
+  std::string skim_rows;
+
+  HistSet() {}
+
+  // min_pid and max_pid bound the process IDs declared in the run info
+  HistSet(int min_pid, int max_pid) {
+    TrueChannelToFSTopo = FastHist(
+        "TrueChannelToFSTopo", ";FSTopo;TrueChannel;Count",
+        FastAxis(kNumClass, 0, kNumClass),
+        FastAxis(max_pid - min_pid, min_pid, max_pid));
+
+    PrimaryToFinalStateSmearing =
+        FastHist("PrimaryToFinalStateSmearing",
+                 ";Final State topo.;Post-Hard Scatter topo.;Count",
+                 FastAxis(kNumClass, 0, kNumClass),
+                 FastAxis(pclasses.size(), 0, pclasses.size()));
+
+    std::vector<double> xbins = {0, 1E-8};
+    for (int i = 0; i < 80; ++i) {
+      xbins.push_back(xbins.back() + (1. / 80.));
+    }
+    std::vector<double> ybins_prot = {0, 1E-8};
+    for (int i = 0; i < 50; ++i) {
+      ybins_prot.push_back(ybins_prot.back() + (1. / 50.));
+    }
+    std::vector<double> ybins_piplus = {0, 1E-8};
+    for (int i = 0; i < 50; ++i) {
+      ybins_piplus.push_back(ybins_piplus.back() + (1 / 50.));
+    }
+
+    PreFSIKinematics_1p = FastHist("PreFSIKinematics_1p",
+                                   ";T_{prot}^{preFSI};Count", ybins_prot);
+
+    TotalNeutronKE_1p_only = FastHist(
+        "TotalNeutronKE_1p_only", ";#sum T_{neutron};T_{prot}^{preFSI};Count",
+        xbins, ybins_prot);
+    TotalNeutralE_1p_only = FastHist(
+        "TotalNeutralE_1p_only", ";#sum E_{neutral};T_{prot}^{preFSI};Count",
+        xbins, ybins_prot);
+
+    PreFSIKinematics_1piplus_1p = FastHist(
+        "PreFSIKinematics_1piplus_1p", ";T_{prot}^{preFSI};T_{#pi+}^{preFSI};",
+        ybins_prot, ybins_piplus);
+
+    TotalPi0E_1piplus_1p = FastHist(
+        "TotalPi0E_1piplus_1p",
+        ";#sum E_{#pi^{0}};T_{prot}^{preFSI};T_{#pi+}^{preFSI};Count", xbins,
+        ybins_prot, ybins_piplus);
+    TotalNeutralE_1piplus_1p = FastHist(
+        "TotalNeutralE_1piplus_1p",
+        ";#sum E_{neutral};T_{prot}^{preFSI};T_{#pi+}^{preFSI};Count", xbins,
+        ybins_prot, ybins_piplus);
+
+    for (auto c : pclasses) {
+      Transparency[c] = TransparencyFact(c);
+      Transparency_5deg[c] = TransparencyFact(c, "_lt5deg");
+    }
+  }
+
+  // every histogram in a fixed order, unbooked transparency slots included
+  std::vector<FastHist *> Hists() {
+    std::vector<FastHist *> hs = {&TrueChannelToFSTopo,
+                                  &PreFSIKinematics_1p,
+                                  &TotalNeutronKE_1p_only,
+                                  &TotalNeutralE_1p_only,
+                                  &PreFSIKinematics_1piplus_1p,
+                                  &TotalPi0E_1piplus_1p,
+                                  &TotalNeutralE_1piplus_1p,
+                                  &PrimaryToFinalStateSmearing};
+    for (int c = 0; c < kNumClass; ++c) {
+      hs.push_back(&Transparency[c].first);
+      hs.push_back(&Transparency[c].second);
+      hs.push_back(&Transparency_5deg[c].first);
+      hs.push_back(&Transparency_5deg[c].second);
+    }
+    return hs;
+  }
+  std::vector<FastHist const *> Hists() const {
+    auto hs = const_cast<HistSet *>(this)->Hists();
+    return {hs.begin(), hs.end()};
+  }
+
+  // must be called before anything is filled
+  void SetUniverses(std::vector<size_t> const &u,
+                    std::vector<std::string> const &names) {
+    universes = u;
+    universe_names = names;
+    uweights.assign(u.size(), 0);
+    for (auto h : Hists()) {
+      if (h->IsBooked()) {
+        h->SetNUniverses(u.size());
+      }
+    }
+  }
+
+  // one weight per universe
+  double const *Weights(std::vector<double> const &weights) {
+    if (universes.empty()) {
+      return weights.data();
+    }
+    for (size_t u = 0; u < universes.size(); ++u) {
+      uweights[u] = weights[universes[u]];
+    }
+    return uweights.data();
+  }
+
+  void Add(HistSet const &other) {
+    auto hs = Hists();
+    auto ohs = other.Hists();
+    for (size_t i = 0; i < hs.size(); ++i) {
+      hs[i]->Add(*ohs[i]);
+    }
+  }
+
+  // Add(other) followed by clearing other
+  void AddAndClear(HistSet &other) {
+    auto hs = Hists();
+    auto ohs = other.Hists();
+    for (size_t i = 0; i < hs.size(); ++i) {
+      hs[i]->AddAndClear(*ohs[i]);
+    }
+  }
+
+  void Save(std::ostream &os) const {
+    for (auto h : Hists()) {
+      h->Save(os);
+    }
+  }
+  void Load(std::istream &is) {
+    for (auto h : Hists()) {
+      h->Load(is);
+    }
+  }
+
+  // writes every universe, each to its own subdirectory of dout if there is
+  // more than the default one
+  void Write(TDirectory *dout) const {
+    if (universes.empty()) {
+      Write(dout, 0);
+      return;
+    }
+    for (size_t u = 0; u < universes.size(); ++u) {
+      Write(dout->mkdir(universe_names[u].c_str()), u);
+    }
+  }
+
+  void Write(TDirectory *dout, size_t u) const {
+    auto smearing = PrimaryToFinalStateSmearing.ToTH2D(u);
+    for (int i = 0; i < smearing->GetXaxis()->GetNbins(); ++i) {
+      smearing->GetXaxis()->SetBinLabel(i + 1, Topologies[i].label);
+    }
+
+    for (int i = 0; i < smearing->GetYaxis()->GetNbins(); ++i) {
+      smearing->GetYaxis()->SetBinLabel(i + 1, Topologies[pclasses[i]].label);
+    }
+
+    auto channel = TrueChannelToFSTopo.ToTH2D(u);
+    for (int i = 0; i < channel->GetXaxis()->GetNbins(); ++i) {
+      channel->GetXaxis()->SetBinLabel(i + 1, Topologies[i].label);
+    }
+
+    dout->WriteObject(channel.release(), "TrueChannelToFSTopo");
+    dout->WriteObject(smearing.release(), "PrimaryToFinalStateSmearing");
+
+    dout->WriteObject(PreFSIKinematics_1p.ToTH1D(u).release(),
+                      "PreFSIKinematics_1p");
+
+    dout->WriteObject(TotalNeutronKE_1p_only.ToTH2D(u).release(),
+                      "TotalNeutronKE_1p_only");
+    dout->WriteObject(TotalNeutralE_1p_only.ToTH2D(u).release(),
+                      "TotalNeutralE_1p_only");
+
+    WriteSmoothed(dout, PreFSIKinematics_1piplus_1p.ToTH2D(u),
+                  "PreFSIKinematics_1piplus_1p");
+
+    dout->WriteObject(TotalPi0E_1piplus_1p.ToTH3D(u).release(),
+                      "TotalPi0E_1piplus_1p");
+    dout->WriteObject(TotalNeutralE_1piplus_1p.ToTH3D(u).release(),
+                      "TotalNeutralE_1piplus_1p");
+
+    for (auto const &t : Transparency) {
+      if (t.first.IsBooked()) {
+        WriteTransparency(dout, t.first.ToTH1D(u), t.second.ToTH1D(u));
+      }
+    }
+    for (auto const &t : Transparency_5deg) {
+      if (t.first.IsBooked()) {
+        WriteTransparency(dout, t.first.ToTH1D(u), t.second.ToTH1D(u));
+      }
+    }
+  }
+};
+
+// Sums the per-block HistSets of the analysis threads into the total in block
+// order, whichever thread filled them and whenever they finish. Every event is
+// then summed in the same order for any number of threads, so that the output
+// only depends on the block size. The skim rows of each block are written at
+// the same point, one segment per block.
+class OrderedSum {
+  HistSet &total;
+  size_t next;
+  std::mutex m;
+  std::condition_variable cv;
+
+public:
+  // first is the number of the first block to be summed
+  OrderedSum(HistSet &t, size_t first = 0) : total(t), next(first) {}
+
+  // sums and clears block, the one numbered seq, once every earlier block
+  // has been summed. Every number from first on must be summed once.
+  void Add(size_t seq, HistSet &block) {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&]() { return next == seq; });
+    total.AddAndClear(block);
+    if (block.skim) {
+      block.skim->AddSegment(block.skim_rows);
+    }
+    next++;
+    cv.notify_all();
+  }
+};
+
+std::pair<double, double> GetNeutronNeutralEnergy(ParticleView const &fs) {
+  std::pair<double, double> NeutronNeutralEnergy{0, 0};
+  for (auto const &pt : fs) {
+    switch (std::abs(pt.pid)) {
+    case 111: {
+      NeutronNeutralEnergy.second += pt.mom.e();
+    }
+    case 2112: {
+      double Tneut = pt.KE;
+      NeutronNeutralEnergy.first += Tneut;
+      NeutronNeutralEnergy.second += Tneut;
+    }
+    }
+  }
+  return NeutronNeutralEnergy;
+}
+
+std::pair<Particle const *, Particle const *>
+GetPrimaryParticles(Classification c, ParticleView const &parts) {
+
+  std::pair<Particle const *, Particle const *> pparts{nullptr, nullptr};
+
+  for (auto const &part : parts) {
+    switch (c) {
+    case k1p_only: {
+      if (part.pid == 2212) {
+        return {&part, nullptr};
+      }
+    }
+    case k1n_only: {
+      if (part.pid == 2112) {
+        return {&part, nullptr};
+      }
+    }
+    case k1pi0_1p: {
+      if (part.pid == 111) {
+        pparts.first = &part;
+      }
+      if (part.pid == 2212) {
+        pparts.second = &part;
+      }
+    }
+    case k1piplus_1p: {
+      if (part.pid == 211) {
+        pparts.first = &part;
+      }
+      if (part.pid == 2212) {
+        pparts.second = &part;
+      }
+    }
+    }
+  }
+  return pparts;
+}
+
+// the derived quantities of an indexed event whose primary topology is
+// pclass, idx.process_id must be set
+SkimEvent Summarise(EventIndex const &idx, Classification pclass,
+                    Classification fsclass, StageClock &clk) {
+  SkimEvent ev{pclass,
+               fsclass,
+               idx.process_id,
+               0,
+               std::numeric_limits<double>::quiet_NaN(),
+               std::numeric_limits<double>::quiet_NaN(),
+               0,
+               0,
+               0};
+
+  auto primparts = GetPrimaryParticles(pclass, idx.Primary());
+  clk.Lap(kPrimaryParticles);
+
+  ev.primary_KE = primparts.first->KE * ToGeV;
+  if (primparts.second) {
+    ev.secondary_KE = primparts.second->KE * ToGeV;
+  }
+
+  if (fsclass == pclass) {
+    auto fspparts = GetPrimaryParticles(pclass, idx.FinalState());
+    clk.Lap(kPrimaryParticles);
+
+    auto const &fs_mom = fspparts.first->mom;
+    auto const &prim_mom = primparts.first->mom;
+
+    double costheta = (fs_mom.x() * prim_mom.x() + fs_mom.y() * prim_mom.y() +
+                       fs_mom.z() * prim_mom.z()) /
+                      (fs_mom.length() * prim_mom.length());
+
+    ev.deflection = std::acos((costheta > 1) ? 1 : costheta) * 180.0 / M_PI;
+  } // end if topo stayed the same
+
+  auto NeutronNeutralEnergy = GetNeutronNeutralEnergy(idx.FinalState());
+  ev.neutron_KE = NeutronNeutralEnergy.first * ToGeV;
+  ev.neutral_E = NeutronNeutralEnergy.second * ToGeV;
+  ev.pi0_E = (NeutronNeutralEnergy.second - NeutronNeutralEnergy.first) * ToGeV;
+  clk.Lap(kPrimaryParticles);
+  return ev;
+}
+
+// fills hs from the derived quantities of an event, w holds one weight per
+// universe
+void FillEvent(SkimEvent const &ev, double const *w, HistSet &hs) {
+  hs.PrimaryToFinalStateSmearing.Fill(ev.fsclass, ev.pclass, 1);
+  hs.TrueChannelToFSTopo.Fill(ev.fsclass, ev.process_id, 1);
+
+  double pKE = ev.primary_KE;
+
+  if (ev.fsclass == ev.pclass) {
+    if (ev.deflection < 5) {
+      hs.Transparency_5deg[ev.pclass].first.Fill(pKE, w);
+    }
+    hs.Transparency[ev.pclass].first.Fill(pKE, w);
+  }
+
+  hs.Transparency_5deg[ev.pclass].second.Fill(pKE, w);
+  hs.Transparency[ev.pclass].second.Fill(pKE, w);
+
+  switch (ev.pclass) {
+  case k1p_only: {
+    hs.TotalNeutronKE_1p_only.Fill(ev.neutron_KE, pKE, w);
+    hs.TotalNeutralE_1p_only.Fill(ev.neutral_E, pKE, w);
+    hs.PreFSIKinematics_1p.Fill(pKE, w);
+    break;
+  }
+  case k1piplus_1p: {
+    double pprotKE = ev.secondary_KE;
+
+    hs.TotalPi0E_1piplus_1p.Fill(ev.pi0_E, pprotKE, pKE, w);
+    hs.TotalNeutralE_1piplus_1p.Fill(ev.neutral_E, pprotKE, pKE, w);
+
+    hs.PreFSIKinematics_1piplus_1p.Fill(pprotKE, pKE, w);
+
+    break;
+  }
+  }
+}
+
+// fills hs from an indexed event already found to have one of the selected
+// primary topologies, pclass, idx.process_id must be set
+void ProcessSelected(EventIndex const &idx, Classification pclass,
+                     HistSet &hs, StageClock &clk) {
+  auto fsclass = FSClassification(idx);
+  clk.Lap(kClassify);
+
+  auto ev = Summarise(idx, pclass, fsclass, clk);
+
+  double const *w = hs.Weights(idx.weights);
+  if (hs.skim) {
+    hs.skim->Add(hs.skim_rows, ev, w);
+  }
+  FillEvent(ev, w, hs);
+  clk.Lap(kFill);
+}
+
+// fills hs from an indexed event, idx.process_id must be set
+void ProcessEvent(EventIndex const &idx, HistSet &hs, StageClock &clk) {
+  auto pclass = PrimaryClassification(idx);
+  if (std::find(pclasses.begin(), pclasses.end(), pclass) == pclasses.end()) {
+    clk.Lap(kClassify);
+    return;
+  }
+  ProcessSelected(idx, pclass, hs, clk);
+}
+
+void ProcessEvent(HepMC3::GenEvent &evt, HistSet &hs, StageClock &clk) {
+  auto &idx = ScratchEventIndex();
+  idx.Build(evt, ToGeV, isGENIE);
+  clk.Lap(kIndex);
+
+  // reading the process ID attribute allocates, only do it for events that
+  // will be used
+  auto pclass = PrimaryClassification(idx);
+  if (std::find(pclasses.begin(), pclasses.end(), pclass) == pclasses.end()) {
+    clk.Lap(kClassify);
+    return;
+  }
+  clk.Lap(kClassify);
+  idx.process_id = NuHepMC::ER3::ReadProcessID(evt);
+  clk.Lap(kIndex);
+
+  ProcessSelected(idx, pclass, hs, clk);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "TArrayD.h"
+#include "TH1D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A band of y (and for a 3D histogram z) bins to project onto x, with
+// inclusive bin ranges. The projection drops the first x bin and is then
+// rebinned by rebin, as CutOffZeroBin(h->ProjectionX(name, ...), rebin) does.
+struct XSlice {
+  std::string name;
+  int y1, y2;
+  int z1 = 0, z2 = 0;
+  int rebin = 1;
+};
+
+// Projects a TH2D or TH3D onto x for every slice in a single sweep over its
+// bin arrays. The rows of each (y, z) bin are contiguous and are visited in
+// the order in which ProjectionX sums them, so the contents and errors are
+// identical to projecting each slice separately, without the intermediate
+// full range projections and copies.
+inline std::vector<std::unique_ptr<TH1D>>
+ProjectSlicesX(TH1 const &h, std::vector<XSlice> const &slices) {
+  auto arr = dynamic_cast<TArrayD const *>(&h);
+  if (!arr || (h.GetDimension() < 2)) {
+    throw std::runtime_error(std::string("Cannot project slices of ") +
+                             h.GetName());
+  }
+
+  // errors are stored as SetBinError would store them
+  auto sq = [](double e2) {
+    double e = std::sqrt(e2);
+    return e * e;
+  };
+
+  int nx = h.GetXaxis()->GetNbins();
+  int ny = h.GetYaxis()->GetNbins();
+  bool is3D = h.GetDimension() == 3;
+  double const *c = arr->GetArray();
+  double const *e2 = h.GetSumw2N() ? h.GetSumw2()->GetArray() : nullptr;
+
+  // accumulated over x bins [2, nx], the first and the flows are dropped
+  int n = nx - 1;
+  std::vector<std::vector<double>> sumc(slices.size(),
+                                        std::vector<double>(n, 0));
+  std::vector<std::vector<double>> sume2 = sumc;
+
+  int ylo = ny + 1, yhi = 0, zlo = is3D ? h.GetZaxis()->GetNbins() + 1 : 0,
+      zhi = 0;
+  for (auto const &s : slices) {
+    ylo = std::min(ylo, s.y1);
+    yhi = std::max(yhi, s.y2);
+    if (is3D) {
+      zlo = std::min(zlo, s.z1);
+      zhi = std::max(zhi, s.z2);
+    }
+  }
+
+  for (int y = ylo; y <= yhi; ++y) {
+    for (int z = zlo; z <= zhi; ++z) {
+      size_t row = (size_t(z) * (ny + 2) + y) * (nx + 2) + 2;
+      for (size_t i = 0; i < slices.size(); ++i) {
+        auto const &s = slices[i];
+        if ((y < s.y1) || (y > s.y2) ||
+            (is3D && ((z < s.z1) || (z > s.z2)))) {
+          continue;
+        }
+        double *__restrict sc = sumc[i].data();
+        double *__restrict se2 = sume2[i].data();
+        for (int x = 0; x < n; ++x) {
+          sc[x] += c[row + x];
+          se2[x] += e2 ? e2[row + x] : std::abs(c[row + x]);
+        }
+      }
+    }
+  }
+
+  std::vector<double> edges;
+  for (int x = 2; x <= nx + 1; ++x) {
+    edges.push_back(h.GetXaxis()->GetBinLowEdge(x));
+  }
+  std::string title = std::string(";") + h.GetXaxis()->GetTitle() + ";";
+
+  std::vector<std::unique_ptr<TH1D>> out;
+  for (size_t i = 0; i < slices.size(); ++i) {
+    int rebin = std::max(1, slices[i].rebin);
+    // as TH1::Rebin, bins left over from the last full group go to overflow
+    int nbins = n / rebin;
+    std::vector<double> redges;
+    for (int b = 0; b <= nbins; ++b) {
+      redges.push_back(edges[b * rebin]);
+    }
+
+    out.emplace_back(new TH1D((slices[i].name + "_nozero").c_str(),
+                              title.c_str(), nbins, redges.data()));
+    auto &p = out.back();
+    p->SetDirectory(nullptr);
+    p->Sumw2();
+    double *pc = p->GetArray();
+    double *pe2 = p->GetSumw2()->GetArray();
+    for (int b = 0; b <= nbins; ++b) {
+      double bc = 0, be2 = 0;
+      int end = (b == nbins) ? n : (b + 1) * rebin;
+      for (int x = b * rebin; x < end; ++x) {
+        bc += sumc[i][x];
+        be2 += sq(sume2[i][x]);
+      }
+      pc[b + 1] = bc;
+      pe2[b + 1] = (rebin > 1) ? sq(be2) : be2;
+    }
+    p->ResetStats();
+  }
+  return out;
+}
@@ -0,0 +1,337 @@
+#pragma once
+
+#include "TDirectory.h"
+#include "TNamed.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Streaming XXH64, seed 0, so that file hashes can be checked with
+// xxhsum -H64. It reads at memory bandwidth, which keeps hashing a multi-GB
+// input small next to analysing it.
+class XXH64 {
+  static constexpr uint64_t P1 = 11400714785074694791ULL;
+  static constexpr uint64_t P2 = 14029467366897019727ULL;
+  static constexpr uint64_t P3 = 1609587929392839161ULL;
+  static constexpr uint64_t P4 = 9650029242287828579ULL;
+  static constexpr uint64_t P5 = 2870177450012600261ULL;
+
+  uint64_t v[4] = {P1 + P2, P2, 0, 0 - P1};
+  uint64_t total = 0;
+  // the tail of the input that does not yet fill a 32 byte stripe
+  unsigned char buf[32];
+  size_t nbuf = 0;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t read64(unsigned char const *p) {
+    uint64_t x;
+    std::memcpy(&x, p, 8);
+    return x;
+  }
+  static uint32_t read32(unsigned char const *p) {
+    uint32_t x;
+    std::memcpy(&x, p, 4);
+    return x;
+  }
+  static uint64_t round(uint64_t acc, uint64_t in) {
+    return rotl(acc + in * P2, 31) * P1;
+  }
+  static uint64_t merge(uint64_t h, uint64_t acc) {
+    return (h ^ round(0, acc)) * P1 + P4;
+  }
+  void stripe(unsigned char const *p) {
+    for (int i = 0; i < 4; ++i) {
+      v[i] = round(v[i], read64(p + 8 * i));
+    }
+  }
+
+public:
+  // the hash is defined for little-endian reads
+  void Update(void const *data, size_t n) {
+    auto p = static_cast<unsigned char const *>(data);
+    total += n;
+    if (nbuf) {
+      size_t take = std::min(n, 32 - nbuf);
+      std::memcpy(buf + nbuf, p, take);
+      nbuf += take;
+      p += take;
+      n -= take;
+      if (nbuf < 32) {
+        return;
+      }
+      stripe(buf);
+      nbuf = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32) {
+      stripe(p);
+    }
+    std::memcpy(buf, p, n);
+    nbuf = n;
+  }
+
+  uint64_t Digest() const {
+    uint64_t h;
+    if (total >= 32) {
+      h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+      for (int i = 0; i < 4; ++i) {
+        h = merge(h, v[i]);
+      }
+    } else {
+      h = P5;
+    }
+    h += total;
+
+    unsigned char const *p = buf;
+    size_t n = nbuf;
+    for (; n >= 8; p += 8, n -= 8) {
+      h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    }
+    if (n >= 4) {
+      h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3;
+      p += 4;
+      n -= 4;
+    }
+    for (; n; ++p, --n) {
+      h = rotl(h ^ (*p * P5), 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+};
+
+// the XXH64 of the content of fname as 16 hex digits
+inline std::string FileHash(std::string const &fname) {
+  std::ifstream ifs(fname, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error("Failed to open " + fname + " to hash it");
+  }
+  XXH64 h;
+  std::vector<char> buf(1 << 20);
+  while (ifs) {
+    ifs.read(buf.data(), buf.size());
+    h.Update(buf.data(), size_t(ifs.gcount()));
+  }
+  if (!ifs.eof()) {
+    throw std::runtime_error("Failed to read " + fname);
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx",
+                static_cast<unsigned long long>(h.Digest()));
+  return hex;
+}
+
+// the modification time of fname as <seconds>.<nanoseconds>, empty if it
+// cannot be stat'd
+inline std::string FileMTime(std::string const &fname) {
+  struct stat st;
+  if (stat(fname.c_str(), &st)) {
+    return "";
+  }
+  return std::to_string(st.st_mtim.tv_sec) + "." +
+         std::to_string(st.st_mtim.tv_nsec);
+}
+
+// File hashes memoized in a directory, one entry per path holding the hash
+// and the device, inode, size and modification time of the file when it was
+// hashed, so that an unchanged file is only read once. Like make, a rewrite
+// that keeps the size within the filesystem's mtime resolution goes unnoticed.
+// Failing to read or write the memo is not an error, the file is just hashed
+// again. The directory is only created once something is hashed.
+class HashMemo {
+  std::filesystem::path dir;
+
+  static std::string Stamp(std::string const &fname) {
+    struct stat st;
+    if (stat(fname.c_str(), &st)) {
+      return "";
+    }
+    return std::to_string(st.st_dev) + " " + std::to_string(st.st_ino) + " " +
+           std::to_string(st.st_size) + " " + FileMTime(fname);
+  }
+
+  std::filesystem::path Entry(std::string const &fname) const {
+    std::error_code ec;
+    std::string path = std::filesystem::absolute(fname, ec).string();
+    XXH64 h;
+    h.Update(path.data(), path.size());
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx",
+                  static_cast<unsigned long long>(h.Digest()));
+    return dir / hex;
+  }
+
+public:
+  explicit HashMemo(std::filesystem::path const &dir_) : dir(dir_) {}
+
+  // $XDG_CACHE_HOME/nustecana/hashes, or under ~/.cache
+  static std::filesystem::path DefaultDir() {
+    std::filesystem::path base = "/tmp";
+    char const *xdg = std::getenv("XDG_CACHE_HOME");
+    char const *home = std::getenv("HOME");
+    if (xdg && *xdg) {
+      base = xdg;
+    } else if (home && *home) {
+      base = std::filesystem::path(home) / ".cache";
+    }
+    return base / "nustecana" / "hashes";
+  }
+
+  // the memoized hash of fname as it is now, empty if there is none
+  std::string Get(std::string const &fname) const {
+    std::ifstream ifs(Entry(fname));
+    std::string stamp, hash;
+    if (!std::getline(ifs, stamp) || !std::getline(ifs, hash)) {
+      return "";
+    }
+    std::string now = Stamp(fname);
+    return (now.size() && (stamp == now)) ? hash : "";
+  }
+
+  // the hash of fname, only reading it if the memo is missing or stale
+  std::string Hash(std::string const &fname) const {
+    std::string hash = Get(fname);
+    if (hash.size()) {
+      return hash;
+    }
+    // stamped before reading, so a change during hashing leaves it stale
+    std::string stamp = Stamp(fname);
+    hash = FileHash(fname);
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    auto entry = Entry(fname);
+    auto tmp = entry;
+    tmp += ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream ofs(tmp);
+      ofs << stamp << "\n" << hash << "\n";
+    }
+    std::filesystem::rename(tmp, entry, ec);
+    if (ec) {
+      std::filesystem::remove(tmp, ec);
+    }
+    return hash;
+  }
+};
+
+// One input that contributed to an output: its content hash, size and
+// modification time, the events [first, first + nevents) of it that were
+// analysed, however the slice was given, and its absolute path when it was
+// added. A plain run does not read the input again to hash it, the hash is
+// only filled in where the overlap of inputs is checked.
+struct InputRecord {
+  std::string hash;
+  uint64_t size = 0;
+  std::string mtime;
+  uint64_t first = 0;
+  uint64_t nevents = 0;
+  std::string path;
+
+  // the events as [first, last) for messages
+  std::string Events() const {
+    return "events [" + std::to_string(first) + ", " +
+           std::to_string(first + nevents) + ")";
+  }
+
+  // the same content, or the same unchanged file if either was not hashed
+  bool SameInput(InputRecord const &other) const {
+    if (hash.size() && other.hash.size()) {
+      return hash == other.hash;
+    }
+    return mtime.size() && (path == other.path) && (size == other.size) &&
+           (mtime == other.mtime);
+  }
+
+  // any event of the same input in both
+  bool Overlaps(InputRecord const &other) const {
+    return SameInput(other) && nevents && other.nevents &&
+           (first < (other.first + other.nevents)) &&
+           (other.first < (first + nevents));
+  }
+};
+
+// Fills in the hashes of the records written without one from their files,
+// if those are still the ones that were analysed. Each distinct file is
+// hashed at most once, however many records it has, and one that has since
+// gone or changed keeps no hash.
+inline void ResolveHashes(std::vector<InputRecord> &recs,
+                          HashMemo const &memo) {
+  std::map<std::string, std::string> hashes;
+  for (auto &r : recs) {
+    if (r.hash.size() || r.mtime.empty()) {
+      continue;
+    }
+    std::string id = r.path + " " + std::to_string(r.size) + " " + r.mtime;
+    auto it = hashes.find(id);
+    if (it == hashes.end()) {
+      std::string hash;
+      std::error_code ec;
+      if ((FileMTime(r.path) == r.mtime) &&
+          (std::filesystem::file_size(r.path, ec) == r.size) && !ec) {
+        try {
+          hash = memo.Hash(r.path);
+        } catch (std::exception const &) {
+        }
+      }
+      it = hashes.emplace(id, hash).first;
+    }
+    r.hash = it->second;
+  }
+}
+
+constexpr char const *ProvenanceName = "NuSTECProvenance";
+
+inline std::vector<InputRecord> ReadProvenance(TDirectory *d) {
+  std::vector<InputRecord> recs;
+  std::unique_ptr<TNamed> prov(d->Get<TNamed>(ProvenanceName));
+  if (!prov) {
+    return recs;
+  }
+  std::stringstream ss(prov->GetTitle());
+  std::string line;
+  while (std::getline(ss, line)) {
+    std::stringstream ls(line);
+    InputRecord r;
+    if (ls >> r.hash >> r.size >> r.mtime >> r.first >> r.nevents) {
+      std::getline(ls >> std::ws, r.path);
+      for (auto s : {&r.hash, &r.mtime}) {
+        if (*s == "-") {
+          s->clear();
+        }
+      }
+      recs.push_back(r);
+    }
+  }
+  return recs;
+}
+
+inline void WriteProvenance(TDirectory *d,
+                            std::vector<InputRecord> const &recs) {
+  std::stringstream ss;
+  for (auto const &r : recs) {
+    ss << (r.hash.size() ? r.hash : "-") << " " << r.size << " "
+       << (r.mtime.size() ? r.mtime : "-") << " " << r.first << " "
+       << r.nevents << " " << r.path << "\n";
+  }
+  TNamed prov(ProvenanceName, ss.str().c_str());
+  // replaces any earlier record in d
+  d->WriteObject(&prov, ProvenanceName, "WriteDelete");
+}
@@ -0,0 +1,235 @@
+#include "parallelinput.hxx"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+// The largest input of one BGZF block, which leaves room for the block
+// header and for deflate's expansion of incompressible data within the
+// 64 KiB limit, as bgzip does.
+constexpr size_t kBGZFInput = 0xff00;
+
+void Put16(std::string &s, uint16_t v) {
+  s += char(v & 0xFF);
+  s += char(v >> 8);
+}
+void Put32(std::string &s, uint32_t v) {
+  Put16(s, v & 0xFFFF);
+  Put16(s, v >> 16);
+}
+
+// compresses in as a run of BGZF blocks
+std::string CompressBGZF(std::string const &in) {
+  std::string out;
+  for (size_t off = 0; off < in.size(); off += kBGZFInput) {
+    size_t n = std::min(kBGZFInput, in.size() - off);
+    auto src = reinterpret_cast<Bytef const *>(in.data() + off);
+
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw std::runtime_error("Failed to initialise deflate");
+    }
+    std::string cdata(deflateBound(&z, uLong(n)), '\0');
+    z.next_in = const_cast<Bytef *>(src);
+    z.avail_in = uInt(n);
+    z.next_out = reinterpret_cast<Bytef *>(&cdata[0]);
+    z.avail_out = uInt(cdata.size());
+    int rc = deflate(&z, Z_FINISH);
+    cdata.resize(cdata.size() - z.avail_out);
+    deflateEnd(&z);
+    if (rc != Z_STREAM_END) {
+      throw std::runtime_error("Failed to deflate a BGZF block");
+    }
+
+    // gzip header with the BC extra subfield holding the block size - 1
+    std::string hdr("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+    Put16(hdr, 6);
+    hdr += "BC";
+    Put16(hdr, 2);
+    Put16(hdr, uint16_t(18 + cdata.size() + 8 - 1));
+
+    out += hdr;
+    out += cdata;
+    Put32(out, uint32_t(crc32(crc32(0, nullptr, 0), src, uInt(n))));
+    Put32(out, uint32_t(n));
+  }
+  return out;
+}
+
+// compresses in as one complete bzip2 stream
+std::string CompressBzip2(std::string const &in) {
+  std::string out(in.size() + in.size() / 100 + 600, '\0');
+  unsigned int nout = unsigned(out.size());
+  if (BZ2_bzBuffToBuffCompress(&out[0], &nout, const_cast<char *>(in.data()),
+                               unsigned(in.size()), 9, 0, 0) != BZ_OK) {
+    throw std::runtime_error("Failed to compress a bzip2 stream");
+  }
+  out.resize(nout);
+  return out;
+}
+
+// Rewrites a HepMC3 file, compressed or not, in a layout that
+// ParallelDecompressor can decompress on several threads:
+//  - .gz as BGZF, independent gzip members of at most 64 KiB that record
+//    their own size, which gzip -d still reads as one file
+//  - .bz2 as one bzip2 stream per 900 kB of input, as pbzip2 writes
+//  - .xz as a multi-block xz stream with 4 MiB blocks, as xz -T writes
+// The compression itself is spread over -j threads.
+int main(int argc, char const *argv[]) {
+
+  size_t nthreads = 1;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j") && ((i + 1) < argc)) {
+      nthreads = std::max(1, std::stoi(argv[++i]));
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (posargs.size() < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [-j <nthreads>] <infile> <outfile.gz|outfile.bz2|outfile.xz>"
+              << std::endl;
+    return 1;
+  }
+
+  std::string inf = posargs[0];
+  std::string outf = posargs[1];
+
+  auto ends_with = [&](std::string const &ext) {
+    return (outf.size() >= ext.size()) &&
+           !outf.compare(outf.size() - ext.size(), ext.size(), ext);
+  };
+  Codec codec = ends_with(".gz")    ? Codec::kGzip
+                : ends_with(".bz2") ? Codec::kBzip2
+                : ends_with(".xz")  ? Codec::kXz
+                                    : Codec::kNone;
+  if (codec == Codec::kNone) {
+    std::cout << "Cannot tell the compression to use from the extension of "
+              << outf << ", expected .gz, .bz2 or .xz" << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<ParallelDecompressorStream> decompressed;
+  std::ifstream raw;
+  std::istream *in = nullptr;
+  try {
+    if (DetectCodec(inf) != Codec::kNone) {
+      decompressed =
+          std::make_unique<ParallelDecompressorStream>(inf, nthreads);
+      in = &decompressed->is;
+    } else {
+      raw.open(inf, std::ios::binary);
+      in = &raw;
+    }
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  if (!*in) {
+    std::cout << "Failed to open " << inf << std::endl;
+    return 1;
+  }
+
+  std::ofstream out(outf, std::ios::binary);
+  if (!out) {
+    std::cout << "Failed to open " << outf << " for writing" << std::endl;
+    return 1;
+  }
+
+  size_t nin = 0, nout = 0;
+  try {
+    if (codec == Codec::kXz) {
+      lzma_mt mt;
+      std::memset(&mt, 0, sizeof(mt));
+      mt.threads = uint32_t(nthreads);
+      mt.block_size = 4 << 20;
+      mt.preset = LZMA_PRESET_DEFAULT;
+      mt.check = LZMA_CHECK_CRC64;
+      lzma_stream xz = LZMA_STREAM_INIT;
+      if (lzma_stream_encoder_mt(&xz, &mt) != LZMA_OK) {
+        throw std::runtime_error("Failed to initialise the xz encoder");
+      }
+
+      std::string ibuf(1 << 20, '\0'), obuf(1 << 20, '\0');
+      lzma_action action = LZMA_RUN;
+      lzma_ret rc = LZMA_OK;
+      while (rc != LZMA_STREAM_END) {
+        if (!xz.avail_in && (action == LZMA_RUN)) {
+          in->read(&ibuf[0], ibuf.size());
+          xz.next_in = reinterpret_cast<uint8_t const *>(ibuf.data());
+          xz.avail_in = size_t(in->gcount());
+          nin += xz.avail_in;
+          if (!*in) {
+            action = LZMA_FINISH;
+          }
+        }
+        xz.next_out = reinterpret_cast<uint8_t *>(&obuf[0]);
+        xz.avail_out = obuf.size();
+        rc = lzma_code(&xz, action);
+        if ((rc != LZMA_OK) && (rc != LZMA_STREAM_END)) {
+          lzma_end(&xz);
+          throw std::runtime_error("Failed to compress with xz (" +
+                                   std::to_string(rc) + ")");
+        }
+        out.write(obuf.data(), obuf.size() - xz.avail_out);
+        nout += obuf.size() - xz.avail_out;
+      }
+      lzma_end(&xz);
+    } else {
+      // each job is compressed independently, with a whole number of BGZF
+      // blocks or one bzip2 stream
+      size_t job_size = (codec == Codec::kGzip) ? (16 * kBGZFInput) : 900000;
+      OrderedWorkers workers(nthreads, (codec == Codec::kGzip)
+                                           ? CompressBGZF
+                                           : CompressBzip2);
+
+      std::string res;
+      auto write_next = [&]() {
+        workers.Next(res);
+        out.write(res.data(), res.size());
+        nout += res.size();
+      };
+
+      while (*in) {
+        std::string job(job_size, '\0');
+        in->read(&job[0], job_size);
+        job.resize(size_t(in->gcount()));
+        if (job.empty()) {
+          break;
+        }
+        nin += job.size();
+        workers.Submit(std::move(job));
+        while (workers.InFlight() >= (2 * nthreads)) {
+          write_next();
+        }
+      }
+      while (workers.InFlight()) {
+        write_next();
+      }
+
+      if (codec == Codec::kGzip) {
+        // the empty block that marks the end of a BGZF file
+        static char const eof[] =
+            "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0\x1b\0\x03\0\0\0\0\0"
+            "\0\0\0\0";
+        out.write(eof, 28);
+        nout += 28;
+      }
+    }
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+
+  if ((decompressed && decompressed->buf.Failed()) || !out.flush()) {
+    std::cout << "Failed to recompress " << inf << " to " << outf << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << nin << " bytes from " << inf << " to " << outf
+            << " as " << nout << " bytes" << std::endl;
+}
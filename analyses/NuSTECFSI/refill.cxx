@@ -0,0 +1,110 @@
+// Leave this at the top to enable features detected at build time in headers in
+// HepMC3
+#include "NuHepMC/HepMC3Features.hxx"
+
+#include "commonana.hxx"
+#include "processevent.hxx"
+#include "skim.hxx"
+
+#include "TFile.h"
+#include "TH1.h"
+#include "TROOT.h"
+
+#include <atomic>
+#include <iostream>
+#include <numeric>
+#include <thread>
+
+// Rebuilds the nustecana histograms from a --skim written by nustecana, with
+// the binning that HistSet has in this build. Each segment is one block of
+// nustecana's analysis, they are filled on up to -j threads and summed in
+// segment order as nustecana sums its blocks, so that with unchanged binning
+// the output is identical to nustecana's.
+int main(int argc, char const *argv[]) {
+
+  TH1::SetDefaultSumw2(true);
+  TH1::AddDirectory(false);
+
+  size_t nthreads = 1;
+  std::vector<std::string> posargs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j") && ((i + 1) < argc)) {
+      nthreads = std::max(1, std::stoi(argv[++i]));
+    } else {
+      posargs.push_back(arg);
+    }
+  }
+
+  if (posargs.size() < 2) {
+    std::cout << "[RUNLIKE]: " << argv[0]
+              << " [-j <nthreads>] <infile.skim> <outfile.root> [output dir]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string out = posargs[1];
+  std::string dir = (posargs.size() > 2) ? posargs[2] : "";
+
+  std::unique_ptr<Skim> skim;
+  try {
+    skim = std::make_unique<Skim>(posargs[0]);
+  } catch (std::exception const &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+
+  ROOT::EnableThreadSafety();
+
+  nthreads = std::min(nthreads, std::max(size_t(1), skim->NSegments()));
+
+  // the total followed by one per thread
+  std::vector<HistSet> hists;
+  hists.emplace_back(skim->MinPid(), skim->MaxPid());
+  auto names = skim->UniverseNames();
+  if (names.size()) {
+    std::vector<size_t> universes(names.size());
+    std::iota(universes.begin(), universes.end(), 0);
+    hists.front().SetUniverses(universes, names);
+  }
+  for (size_t w = 0; w < nthreads; ++w) {
+    hists.push_back(hists.front());
+  }
+
+  OrderedSum sum(hists.front());
+  std::atomic<size_t> next{0};
+  auto fill = [&](size_t w) {
+    for (size_t s; (s = next++) < skim->NSegments();) {
+      auto seg = skim->Segment(s);
+      for (size_t i = seg.first; i < (seg.first + seg.second); ++i) {
+        FillEvent(skim->Event(i), skim->Weights(i), hists[w + 1]);
+      }
+      sum.Add(s, hists[w + 1]);
+    }
+  };
+
+  if (nthreads == 1) {
+    fill(0);
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nthreads; ++w) {
+      workers.emplace_back(fill, w);
+    }
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+
+  TFile fout(out.c_str(), "RECREATE");
+
+  TDirectory *dout = &fout;
+  if (dir.length()) {
+    dout = fout.mkdir(dir.c_str());
+  }
+
+  hists.front().Write(dout);
+  fout.Close();
+
+  std::cout << "Refilled " << skim->NEvents() << " events from " << posargs[0]
+            << " into " << out << std::endl;
+}
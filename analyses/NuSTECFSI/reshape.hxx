@@ -0,0 +1,135 @@
+#pragma once
+
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TH3D.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Reweights the histograms of one sample so that their distribution in the
+// pre-FSI kinematics matches that of a reference sample. The weight of each
+// pre-FSI bin is the ratio of the reference to the sample shape, and bins
+// where that is not a normal number are left alone.
+//
+// The shape's axes are the y (and z) axes of every histogram it is applied
+// to, so each in-range x row of a dependent histogram takes a single weight.
+// Rows are contiguous in ROOT's global bin layout and are scaled directly in
+// the content and sum of squared weights arrays.
+class ShapeReweight {
+  int nx, ny;
+  // indexed by (j - 1) * nx + (i - 1) for shape bin (i, j)
+  std::vector<double> w;
+
+  // n contiguous bins starting at c and e2
+  static void ScaleRow(double *__restrict c, double *__restrict e2, int n,
+                       double w) {
+    double w2 = w * w;
+    for (int i = 0; i < n; ++i) {
+      c[i] *= w;
+      e2[i] *= w2;
+    }
+  }
+
+  static void Check(TH1 const *h, int n, int m, std::string const &name) {
+    if ((h->GetYaxis()->GetNbins() != n) ||
+        (m && (h->GetZaxis()->GetNbins() != m))) {
+      throw std::runtime_error(std::string("Cannot reshape ") + h->GetName() +
+                               " by the binning of " + name);
+    }
+  }
+
+  // written in one go as samples may be reshaped on several threads
+  void Report(std::string const &name, int i, int j, double ref,
+              double smp) const {
+    std::stringstream ss;
+    ss << name << " bin ";
+    if (ny > 1) {
+      ss << "(" << i << "," << j << ")";
+    } else {
+      ss << i;
+    }
+    ss << ": w = " << (ref / smp) << " = (" << ref << "/" << smp << ")\n";
+    std::cout << ss.str() << std::flush;
+  }
+
+public:
+  ShapeReweight(TH1D const &ref, TH1D const &smp)
+      : nx(smp.GetXaxis()->GetNbins()), ny(1), w(nx, 1) {
+    if (ref.GetXaxis()->GetNbins() != nx) {
+      throw std::runtime_error(std::string("Cannot reshape ") +
+                               smp.GetName() + " to a different binning");
+    }
+    for (int i = 0; i < nx; ++i) {
+      double r = ref.GetArray()[i + 1], s = smp.GetArray()[i + 1];
+      if (std::isnormal(r / s)) {
+        w[i] = r / s;
+      } else {
+        Report(smp.GetName(), i, 0, r, s);
+      }
+    }
+  }
+
+  ShapeReweight(TH2D const &ref, TH2D const &smp)
+      : nx(smp.GetXaxis()->GetNbins()), ny(smp.GetYaxis()->GetNbins()),
+        w(nx * ny, 1) {
+    if ((ref.GetXaxis()->GetNbins() != nx) ||
+        (ref.GetYaxis()->GetNbins() != ny)) {
+      throw std::runtime_error(std::string("Cannot reshape ") +
+                               smp.GetName() + " to a different binning");
+    }
+    for (int j = 0; j < ny; ++j) {
+      for (int i = 0; i < nx; ++i) {
+        int bin = (j + 1) * (nx + 2) + i + 1;
+        double r = ref.GetArray()[bin], s = smp.GetArray()[bin];
+        if (std::isnormal(r / s)) {
+          w[j * nx + i] = r / s;
+        } else {
+          Report(smp.GetName(), i, j, r, s);
+        }
+      }
+    }
+  }
+
+  // reweights each row of h by the shape bin of its y bin
+  void Apply(TH2D &h) const {
+    if (ny != 1) {
+      throw std::runtime_error(std::string("Cannot reshape ") + h.GetName() +
+                               " by a 2D shape");
+    }
+    Check(&h, nx, 0, "a 1D shape");
+    if (!h.GetSumw2N()) {
+      h.Sumw2();
+    }
+    int hx = h.GetXaxis()->GetNbins();
+    double *c = h.GetArray();
+    double *e2 = h.GetSumw2()->GetArray();
+    for (int j = 1; j <= nx; ++j) {
+      int row = j * (hx + 2) + 1;
+      ScaleRow(c + row, e2 + row, hx, w[j - 1]);
+    }
+    h.ResetStats();
+  }
+
+  // reweights each row of h by the shape bin of its (y, z) bin
+  void Apply(TH3D &h) const {
+    Check(&h, nx, ny, "a 2D shape");
+    if (!h.GetSumw2N()) {
+      h.Sumw2();
+    }
+    int hx = h.GetXaxis()->GetNbins();
+    double *c = h.GetArray();
+    double *e2 = h.GetSumw2()->GetArray();
+    for (int k = 1; k <= ny; ++k) {
+      for (int j = 1; j <= nx; ++j) {
+        int row = (k * (nx + 2) + j) * (hx + 2) + 1;
+        ScaleRow(c + row, e2 + row, hx, w[(k - 1) * nx + (j - 1)]);
+      }
+    }
+    h.ResetStats();
+  }
+};
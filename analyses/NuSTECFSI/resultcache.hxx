@@ -0,0 +1,123 @@
+#pragma once
+
+#include "provenance.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+// A local on-disk cache of nustecana outputs. Each entry is a complete output
+// file named after the hash of everything that determines its content: the
+// nustecana executable itself, which covers the classification, binning and
+// cuts compiled into it, the content hash of the input and the options that
+// change the output. Entries are written to a temporary name and renamed
+// into place, so concurrent runs sharing a cache only ever see complete
+// entries. The least recently used entries are evicted once the cache grows
+// past its size limit.
+class ResultCache {
+  std::filesystem::path dir;
+  uintmax_t max_bytes;
+
+  std::filesystem::path Entry(std::string const &key) const {
+    return dir / (key + ".root");
+  }
+
+public:
+  ResultCache(std::filesystem::path const &dir_, uintmax_t max_bytes_)
+      : dir(dir_), max_bytes(max_bytes_) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+  }
+
+  // the hash of the parts of a key, which must not contain \0
+  static std::string Key(std::vector<std::string> const &parts) {
+    XXH64 h;
+    for (auto const &p : parts) {
+      h.Update(p.data(), p.size());
+      h.Update("", 1);
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx",
+                  static_cast<unsigned long long>(h.Digest()));
+    return hex;
+  }
+
+  // copies the entry for key to out and marks it as used, false if there is
+  // no such entry
+  bool Fetch(std::string const &key, std::string const &out) const {
+    std::error_code ec;
+    std::string tmp = out + ".tmp" + std::to_string(getpid());
+    std::filesystem::copy_file(
+        Entry(key), tmp, std::filesystem::copy_options::overwrite_existing,
+        ec);
+    if (ec) {
+      // not cached, or evicted by another run while being copied
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+    std::filesystem::rename(tmp, out, ec);
+    if (ec) {
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+    std::filesystem::last_write_time(
+        Entry(key), std::filesystem::file_time_type::clock::now(), ec);
+    return true;
+  }
+
+  // adds out as the entry for key and evicts down to the size limit, returns
+  // false if it could not be added
+  bool Store(std::string const &key, std::string const &out) {
+    std::error_code ec;
+    auto tmp = dir / (key + ".root.tmp" + std::to_string(getpid()));
+    std::filesystem::copy_file(
+        out, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+    if (!ec) {
+      std::filesystem::rename(tmp, Entry(key), ec);
+    }
+    if (ec) {
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+    Evict();
+    return true;
+  }
+
+  // removes the least recently used entries until the cache fits
+  void Evict() {
+    struct Item {
+      std::filesystem::file_time_type used;
+      uintmax_t size;
+      std::filesystem::path path;
+    };
+    std::vector<Item> items;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (auto const &de : std::filesystem::directory_iterator(dir, ec)) {
+      if (de.path().extension() != ".root") {
+        continue;
+      }
+      Item it{de.last_write_time(ec), de.file_size(ec), de.path()};
+      if (!ec) {
+        items.push_back(it);
+        total += it.size;
+      }
+    }
+    std::sort(items.begin(), items.end(), [](Item const &a, Item const &b) {
+      return a.used < b.used;
+    });
+    for (auto const &it : items) {
+      if (total <= max_bytes) {
+        break;
+      }
+      if (std::filesystem::remove(it.path, ec)) {
+        total -= it.size;
+      }
+    }
+  }
+};
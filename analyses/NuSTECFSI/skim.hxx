@@ -0,0 +1,390 @@
+#pragma once
+
+#include "commonana.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the derived quantities of a selected event that the histograms are filled
+// from, the energies are in GeV
+struct SkimEvent {
+  Classification pclass;
+  Classification fsclass;
+  int process_id;
+  // KE of the primary particle of the topology and of the second particle for
+  // the two particle topologies (the proton), NaN if there is none
+  double primary_KE;
+  double secondary_KE;
+  // angle in degrees between the primary particle before and after FSI, NaN
+  // if the topology changed
+  double deflection;
+  double neutron_KE;
+  double neutral_E;
+  double pi0_E;
+};
+
+// Columnar table of the SkimEvents of every event that nustecana selects,
+// laid out like the event cache: a fixed header followed by one flat array
+// per column, each starting on a 64 byte boundary, so that it can be memory
+// mapped and read in place.
+//
+// Per event columns:   pclass, fsclass (int8), process_id (int32),
+//                      primary_KE, secondary_KE, deflection, neutron_KE,
+//                      neutral_E, pi0_E (double),
+//                      weights (double, nuniverses per event)
+// Per segment column:  nevents
+//
+// The events are stored in segments, one per block of the analysis with any
+// selected events, in block order. Refilling each segment into its own HistSet
+// and summing them in order, as nustecana does with its blocks, reproduces its
+// histograms exactly.
+namespace SkimFormat {
+constexpr char Magic[8] = {'N', 'U', 'S', 'T', 'E', 'C', 'S', 'K'};
+constexpr uint32_t Version = 1;
+constexpr size_t Alignment = 64;
+
+enum Column {
+  kPClass = 0,
+  kFSClass,
+  kProcessId,
+  kPrimaryKE,
+  kSecondaryKE,
+  kDeflection,
+  kNeutronKE,
+  kNeutralE,
+  kPi0E,
+  kWeights,
+  kSegmentNEvents,
+  // the \0 separated --weights universe names, empty for the default one
+  kUniverseNames,
+  kNumColumns
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t nsegments;
+  uint64_t nevents;
+  uint64_t nuniverses;
+  // the range of process IDs declared in the run info
+  int32_t min_pid;
+  int32_t max_pid;
+  // byte offset from the start of the file and size in bytes of each column
+  uint64_t col_offset[kNumColumns];
+  uint64_t col_size[kNumColumns];
+};
+} // namespace SkimFormat
+
+// Writes a skim. Each analysis thread collects the fixed size rows of its
+// current block in memory, the segments are then streamed in block order to a
+// temporary file next to the output, and Close() transposes them into columns
+// behind the header.
+class SkimWriter {
+  std::string fname;
+  SkimFormat::Header hdr;
+  std::string universe_names;
+  std::ofstream rows;
+  std::vector<uint64_t> nevents;
+
+  std::string rowname() const { return fname + ".rows"; }
+  size_t rowsize() const {
+    return sizeof(SkimEvent) + hdr.nuniverses * sizeof(double);
+  }
+
+  static size_t ElementSize(int c) {
+    switch (c) {
+    case SkimFormat::kPClass:
+    case SkimFormat::kFSClass: {
+      return sizeof(int8_t);
+    }
+    case SkimFormat::kProcessId: {
+      return sizeof(int32_t);
+    }
+    default: {
+      return sizeof(double);
+    }
+    }
+  }
+
+  // appends column c of a row to out
+  void Extract(int c, char const *row, std::string &out) const {
+    SkimEvent ev;
+    std::memcpy(&ev, row, sizeof(ev));
+    auto put = [&](auto v) {
+      out.append(reinterpret_cast<char const *>(&v), sizeof(v));
+    };
+    switch (c) {
+    case SkimFormat::kPClass: {
+      put(int8_t(ev.pclass));
+      break;
+    }
+    case SkimFormat::kFSClass: {
+      put(int8_t(ev.fsclass));
+      break;
+    }
+    case SkimFormat::kProcessId: {
+      put(int32_t(ev.process_id));
+      break;
+    }
+    case SkimFormat::kPrimaryKE: {
+      put(ev.primary_KE);
+      break;
+    }
+    case SkimFormat::kSecondaryKE: {
+      put(ev.secondary_KE);
+      break;
+    }
+    case SkimFormat::kDeflection: {
+      put(ev.deflection);
+      break;
+    }
+    case SkimFormat::kNeutronKE: {
+      put(ev.neutron_KE);
+      break;
+    }
+    case SkimFormat::kNeutralE: {
+      put(ev.neutral_E);
+      break;
+    }
+    case SkimFormat::kPi0E: {
+      put(ev.pi0_E);
+      break;
+    }
+    case SkimFormat::kWeights: {
+      out.append(row + sizeof(SkimEvent), hdr.nuniverses * sizeof(double));
+      break;
+    }
+    }
+  }
+
+public:
+  // names holds the --weights universe names, empty for the default single
+  // universe
+  SkimWriter(std::string const &fn, int min_pid, int max_pid,
+             std::vector<std::string> const &names)
+      : fname(fn), rows(rowname(), std::ios::binary | std::ios::trunc) {
+    if (!rows) {
+      throw std::runtime_error("Failed to open " + rowname());
+    }
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, SkimFormat::Magic, 8);
+    hdr.version = SkimFormat::Version;
+    hdr.nuniverses = std::max(size_t(1), names.size());
+    hdr.min_pid = min_pid;
+    hdr.max_pid = max_pid;
+    for (auto const &name : names) {
+      universe_names.append(name.c_str(), name.size() + 1);
+    }
+  }
+
+  // adds the row of an event to the rows of a block, w holds one weight per
+  // universe
+  void Add(std::string &block, SkimEvent const &ev, double const *w) const {
+    block.append(reinterpret_cast<char const *>(&ev), sizeof(ev));
+    block.append(reinterpret_cast<char const *>(w),
+                 hdr.nuniverses * sizeof(double));
+  }
+
+  // writes the rows of a block as the next segment, if it has any, and clears
+  // them. Must only be called from one thread at a time.
+  void AddSegment(std::string &block) {
+    if (block.empty()) {
+      return;
+    }
+    rows.write(block.data(), block.size());
+    nevents.push_back(block.size() / rowsize());
+    block.clear();
+  }
+
+  size_t NEvents() const {
+    size_t n = 0;
+    for (auto ns : nevents) {
+      n += ns;
+    }
+    return n;
+  }
+
+  void Close() {
+    rows.close();
+    if (!rows) {
+      throw std::runtime_error("Failed to write the skim segments of " +
+                               fname);
+    }
+    hdr.nsegments = uint32_t(nevents.size());
+    hdr.nevents = NEvents();
+
+    uint64_t offset = sizeof(hdr);
+    for (int c = 0; c < SkimFormat::kNumColumns; ++c) {
+      offset = ((offset + SkimFormat::Alignment - 1) / SkimFormat::Alignment) *
+               SkimFormat::Alignment;
+      hdr.col_offset[c] = offset;
+      if (c == SkimFormat::kSegmentNEvents) {
+        hdr.col_size[c] = nevents.size() * sizeof(uint64_t);
+      } else if (c == SkimFormat::kUniverseNames) {
+        hdr.col_size[c] = universe_names.size();
+      } else {
+        hdr.col_size[c] = hdr.nevents * ElementSize(c) *
+                          ((c == SkimFormat::kWeights) ? hdr.nuniverses : 1);
+      }
+      offset += hdr.col_size[c];
+    }
+
+    std::ofstream out(fname, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Failed to open " + fname);
+    }
+    out.write(reinterpret_cast<char const *>(&hdr), sizeof(hdr));
+
+    // the rows are read once per column, in chunks
+    size_t chunk_rows = std::max(size_t(1), (size_t(1) << 20) / rowsize());
+    std::vector<char> buf(chunk_rows * rowsize());
+    std::string col;
+    for (int c = 0; c < SkimFormat::kNumColumns; ++c) {
+      std::vector<char> pad(hdr.col_offset[c] - uint64_t(out.tellp()), 0);
+      out.write(pad.data(), pad.size());
+
+      if (c == SkimFormat::kSegmentNEvents) {
+        out.write(reinterpret_cast<char const *>(nevents.data()),
+                  hdr.col_size[c]);
+        continue;
+      }
+      if (c == SkimFormat::kUniverseNames) {
+        out.write(universe_names.data(), universe_names.size());
+        continue;
+      }
+      std::ifstream ifs(rowname(), std::ios::binary);
+      while (ifs) {
+        ifs.read(buf.data(), buf.size());
+        size_t n = size_t(ifs.gcount()) / rowsize();
+        col.clear();
+        for (size_t i = 0; i < n; ++i) {
+          Extract(c, buf.data() + i * rowsize(), col);
+        }
+        out.write(col.data(), col.size());
+      }
+    }
+    std::remove(rowname().c_str());
+    if (!out) {
+      throw std::runtime_error("Failed to write " + fname);
+    }
+  }
+};
+
+// read-only memory mapped view of a skim file
+class Skim {
+  int fd;
+  char const *base;
+  size_t size;
+  SkimFormat::Header const *hdr;
+  // the first event of each segment, followed by the number of events
+  std::vector<size_t> seg_first;
+
+  template <typename T> T const *col(SkimFormat::Column c) const {
+    return reinterpret_cast<T const *>(base + hdr->col_offset[c]);
+  }
+
+public:
+  explicit Skim(std::string const &fname)
+      : fd(-1), base(nullptr), size(0), hdr(nullptr) {
+    fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open skim " + fname);
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t(st.st_size) < sizeof(*hdr))) {
+      close(fd);
+      throw std::runtime_error("Failed to stat skim " + fname);
+    }
+    size = st.st_size;
+    void *m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Failed to mmap skim " + fname);
+    }
+    base = static_cast<char const *>(m);
+    hdr = reinterpret_cast<SkimFormat::Header const *>(base);
+
+    if (std::memcmp(hdr->magic, SkimFormat::Magic, 8) ||
+        (hdr->version != SkimFormat::Version)) {
+      munmap(const_cast<char *>(base), size);
+      close(fd);
+      throw std::runtime_error(fname + " is not a version " +
+                               std::to_string(SkimFormat::Version) + " skim");
+    }
+    for (int c = 0; c < SkimFormat::kNumColumns; ++c) {
+      if ((hdr->col_offset[c] + hdr->col_size[c]) > size) {
+        munmap(const_cast<char *>(base), size);
+        close(fd);
+        throw std::runtime_error("Skim " + fname + " is truncated");
+      }
+    }
+
+    auto ns = col<uint64_t>(SkimFormat::kSegmentNEvents);
+    seg_first.assign(1, 0);
+    for (size_t s = 0; s < hdr->nsegments; ++s) {
+      seg_first.push_back(seg_first.back() + ns[s]);
+    }
+  }
+
+  Skim(Skim const &) = delete;
+  Skim &operator=(Skim const &) = delete;
+
+  ~Skim() {
+    if (base) {
+      munmap(const_cast<char *>(base), size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  size_t NEvents() const { return hdr->nevents; }
+  size_t NUniverses() const { return hdr->nuniverses; }
+  size_t NSegments() const { return hdr->nsegments; }
+  int MinPid() const { return hdr->min_pid; }
+  int MaxPid() const { return hdr->max_pid; }
+
+  // the events [first, first + n) of segment s
+  std::pair<size_t, size_t> Segment(size_t s) const {
+    return {seg_first[s], seg_first[s + 1] - seg_first[s]};
+  }
+
+  std::vector<std::string> UniverseNames() const {
+    std::vector<std::string> names;
+    char const *name = col<char>(SkimFormat::kUniverseNames);
+    char const *end = name + hdr->col_size[SkimFormat::kUniverseNames];
+    while (name < end) {
+      names.emplace_back(name);
+      name += names.back().size() + 1;
+    }
+    return names;
+  }
+
+  SkimEvent Event(size_t i) const {
+    return SkimEvent{Classification(col<int8_t>(SkimFormat::kPClass)[i]),
+                     Classification(col<int8_t>(SkimFormat::kFSClass)[i]),
+                     col<int32_t>(SkimFormat::kProcessId)[i],
+                     col<double>(SkimFormat::kPrimaryKE)[i],
+                     col<double>(SkimFormat::kSecondaryKE)[i],
+                     col<double>(SkimFormat::kDeflection)[i],
+                     col<double>(SkimFormat::kNeutronKE)[i],
+                     col<double>(SkimFormat::kNeutralE)[i],
+                     col<double>(SkimFormat::kPi0E)[i]};
+  }
+
+  // one weight per universe
+  double const *Weights(size_t i) const {
+    return col<double>(SkimFormat::kWeights) + i * hdr->nuniverses;
+  }
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Optional per-stage instrumentation of nustecana. Every thread owns one
+// StageStats that only it writes to. The counters are relaxed atomics updated
+// with a plain load and store, so they cost the same as ordinary integers but
+// can still be read by the periodic reporter while the run is going. When
+// instrumentation is disabled a StageClock never reads the clock and every
+// call reduces to a test of a null pointer.
+
+enum Stage { kRead, kIndex, kClassify, kPrimaryParticles, kFill, kNumStages };
+
+constexpr char const *StageNames[kNumStages] = {
+    "read_event", "index", "classify", "primary_particles", "fill"};
+
+class Counter {
+  std::atomic<uint64_t> v{0};
+
+public:
+  // only ever called from the owning thread
+  void add(uint64_t d) {
+    v.store(v.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+  }
+  uint64_t get() const { return v.load(std::memory_order_relaxed); }
+};
+
+struct alignas(64) StageStats {
+  bool enabled = false;
+
+  Counter ns[kNumStages];
+  Counter nevents;
+  Counter nparticles;
+
+  // the slowest events seen by this thread as (ns, event number), timed from
+  // indexing to the last fill as reading happens on another thread. Kept as a
+  // min-heap so that the fastest of them is the one replaced, and only read
+  // once the owning thread has finished.
+  static constexpr size_t NSlowest = 10;
+  std::vector<std::pair<uint64_t, uint64_t>> slowest;
+
+  void Slow(uint64_t evtnum, uint64_t t) {
+    if (slowest.size() < NSlowest) {
+      slowest.emplace_back(t, evtnum);
+      std::push_heap(slowest.begin(), slowest.end(), std::greater<>());
+    } else if (t > slowest.front().first) {
+      std::pop_heap(slowest.begin(), slowest.end(), std::greater<>());
+      slowest.back() = {t, evtnum};
+      std::push_heap(slowest.begin(), slowest.end(), std::greater<>());
+    }
+  }
+};
+
+// charges the time between successive laps to stages
+class StageClock {
+  StageStats *st;
+  std::chrono::steady_clock::time_point start, last;
+
+  static uint64_t ns(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+public:
+  explicit StageClock(StageStats &s) : st(s.enabled ? &s : nullptr) {
+    if (st) {
+      start = last = std::chrono::steady_clock::now();
+    }
+  }
+
+  void Lap(Stage s) {
+    if (!st) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    st->ns[s].add(ns(now - last));
+    last = now;
+  }
+
+  // records the event as a candidate for the slowest, timed from construction
+  void EndEvent(uint64_t evtnum) {
+    if (!st) {
+      return;
+    }
+    st->Slow(evtnum, ns(last - start));
+  }
+};
+
+// sums of the per-thread counters
+struct StageTotals {
+  uint64_t ns[kNumStages] = {0};
+  uint64_t nevents = 0;
+  uint64_t nparticles = 0;
+
+  explicit StageTotals(std::vector<StageStats> const &stats) {
+    for (auto const &s : stats) {
+      for (int i = 0; i < kNumStages; ++i) {
+        ns[i] += s.ns[i].get();
+      }
+      nevents += s.nevents.get();
+      nparticles += s.nparticles.get();
+    }
+  }
+
+  double PerEvent(uint64_t v) const {
+    return nevents ? (double(v) / double(nevents)) : 0;
+  }
+};
+
+// Prints the running totals every interval seconds on its own thread until
+// stopped, then writes the final report as JSON.
+class StageReporter {
+  std::vector<StageStats> const &stats;
+  double interval;
+  std::chrono::steady_clock::time_point start;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stop;
+  std::thread thr;
+
+  void Print() {
+    StageTotals tot(stats);
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    std::cout << "\n[stats] " << tot.nevents << " events, "
+              << (wall > 0 ? (tot.nevents / wall) : 0) << " events/s";
+    for (int i = 0; i < kNumStages; ++i) {
+      std::cout << ", " << StageNames[i] << " " << tot.PerEvent(tot.ns[i])
+                << " ns";
+    }
+    std::cout << std::endl;
+  }
+
+public:
+  StageReporter(std::vector<StageStats> const &s, double i)
+      : stats(s), interval(i), start(std::chrono::steady_clock::now()),
+        stop(false) {
+    if (interval > 0) {
+      thr = std::thread([this]() {
+        std::unique_lock<std::mutex> lk(mtx);
+        while (!cv.wait_for(lk, std::chrono::duration<double>(interval),
+                            [this] { return stop; })) {
+          Print();
+        }
+      });
+    }
+  }
+
+  ~StageReporter() { Stop(); }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stop = true;
+    }
+    cv.notify_all();
+    if (thr.joinable()) {
+      thr.join();
+    }
+  }
+
+  // must only be called once every thread that owns a StageStats has finished
+  void WriteJSON(std::ostream &os, std::string const &input, size_t nthreads,
+                 size_t block_size) const {
+    StageTotals tot(stats);
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    std::vector<std::pair<uint64_t, uint64_t>> slowest;
+    for (auto const &s : stats) {
+      slowest.insert(slowest.end(), s.slowest.begin(), s.slowest.end());
+    }
+    std::sort(slowest.begin(), slowest.end(), std::greater<>());
+    slowest.resize(std::min(slowest.size(), StageStats::NSlowest));
+
+    std::string esc;
+    for (char c : input) {
+      if ((c == '"') || (c == '\\')) {
+        esc += '\\';
+      }
+      esc += c;
+    }
+
+    os << "{\n";
+    os << "  \"input\": \"" << esc << "\",\n";
+    os << "  \"nthreads\": " << nthreads << ",\n";
+    os << "  \"block_size\": " << block_size << ",\n";
+    os << "  \"wall_s\": " << wall << ",\n";
+    os << "  \"events\": " << tot.nevents << ",\n";
+    os << "  \"events_per_s\": " << (wall > 0 ? (tot.nevents / wall) : 0)
+       << ",\n";
+    os << "  \"particles_per_event\": " << tot.PerEvent(tot.nparticles)
+       << ",\n";
+    os << "  \"stages\": {\n";
+    for (int i = 0; i < kNumStages; ++i) {
+      os << "    \"" << StageNames[i]
+         << "\": {\"ns_per_event\": " << tot.PerEvent(tot.ns[i])
+         << ", \"total_s\": " << (tot.ns[i] * 1E-9) << "}"
+         << (((i + 1) < kNumStages) ? "," : "") << "\n";
+    }
+    os << "  },\n";
+    os << "  \"slowest_events\": [\n";
+    for (size_t i = 0; i < slowest.size(); ++i) {
+      os << "    {\"event\": " << slowest[i].second
+         << ", \"ns\": " << slowest[i].first << "}"
+         << (((i + 1) < slowest.size()) ? "," : "") << "\n";
+    }
+    os << "  ]\n";
+    os << "}\n";
+  }
+};